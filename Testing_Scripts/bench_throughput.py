@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+# End-to-end throughput benchmark
+# Runs enhanced_ping in paced mode (-p) against a local responder at increasing
+# rates and appends one CSV row per rate: achieved pps, loss, CPU time per
+# probe and RTT percentiles, labelled with the commit under test so runs on
+# different commits can be compared from the same file. The rate "max" runs
+# the batched flood (-B) instead, to find the ceiling.
+#
+#   sudo python3 Testing_Scripts/bench_throughput.py --responder netns
+#   sudo python3 Testing_Scripts/bench_throughput.py --rates 1000,10000,max --out e2e.csv
+#
+# Responders: "kernel" answers from the host's own stack on 127.0.0.1,
+# "reflector" runs echo_reflector -k on 127.0.0.1, and "netns" runs it behind
+# a veth pair through reflector_netns.sh (target 10.200.0.2).
+
+import argparse
+import csv
+import os
+import re
+import resource
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+REPO_DIR = os.path.dirname(SCRIPT_DIR)
+NETNS_TARGET = "10.200.0.2"
+
+FIELDS = ["label", "responder", "target", "size", "requested_pps", "achieved_pps",
+          "sent", "received", "loss_pct", "cpu_us_per_probe",
+          "rtt_p50_ms", "rtt_p90_ms", "rtt_p99_ms", "rtt_p999_ms"]
+
+
+def build(name, out_dir):
+    """Compile a tool from the repo's current sources into out_dir. Always
+    rebuilt, so the binary measured is the commit the rows are labelled with."""
+    binary = os.path.join(out_dir, name)
+    subprocess.run(["gcc", "-O2", "-o", binary, os.path.join(REPO_DIR, name + ".c"), "-lm", "-pthread"],
+                   check=True)
+    return binary
+
+
+def commit_label():
+    """Short commit hash, with -dirty if the sources differ from it."""
+    try:
+        label = subprocess.run(["git", "-C", REPO_DIR, "rev-parse", "--short", "HEAD"],
+                               capture_output=True, text=True, check=True).stdout.strip()
+        changed = subprocess.run(["git", "-C", REPO_DIR, "status", "--porcelain", "--", "*.c"],
+                                 capture_output=True, text=True, check=True).stdout.strip()
+        return label + ("-dirty" if changed else "")
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def start_responder(kind, build_dir):
+    """Start the responder; returns (process or None, target address)."""
+    if kind == "kernel":
+        return None, "127.0.0.1"
+    reflector = build("echo_reflector", build_dir)
+    if kind == "reflector":
+        proc = subprocess.Popen([reflector, "-k", "-q"], stdout=subprocess.DEVNULL)
+        target = "127.0.0.1"
+    else:
+        proc = subprocess.Popen(["bash", os.path.join(SCRIPT_DIR, "reflector_netns.sh"), "-q"],
+                                stdout=subprocess.DEVNULL, env={**os.environ, "REFLECTOR": reflector})
+        target = NETNS_TARGET
+    time.sleep(1.5)  # Socket open, kernel echo off, namespace up
+    if proc.poll() is not None:
+        sys.exit(f"The {kind} responder failed to start")
+    return proc, target
+
+
+def stop_responder(proc):
+    if proc and proc.poll() is None:
+        proc.send_signal(signal.SIGINT)  # Lets it restore the kernel echo and clean up
+        try:
+            proc.wait(timeout=10)
+        except subprocess.TimeoutExpired:
+            proc.kill()
+
+
+def parse_output(text):
+    """Pull counts, rate and percentiles from enhanced_ping's summary."""
+    row = {}
+    m = re.search(r"Total packets: (\d+) original", text)
+    row["sent"] = int(m.group(1)) if m else 0
+    m = re.search(r"Received: (\d+) \(([\d.]+)% packet loss\)", text)
+    if m:
+        row["received"], row["loss_pct"] = int(m.group(1)), float(m.group(2))
+    m = re.search(r"achieved ([\d.]+) pps", text) or re.search(r"\(([\d.]+) pps sent", text)
+    row["achieved_pps"] = float(m.group(1)) if m else ""
+    m = re.search(r"RTT p50/p90/p99/p99.9 = ([\d.]+)/([\d.]+)/([\d.]+)/([\d.]+) ms", text)
+    for key, value in zip(["rtt_p50_ms", "rtt_p90_ms", "rtt_p99_ms", "rtt_p999_ms"],
+                          m.groups() if m else [""] * 4):
+        row[key] = value
+    return row
+
+
+def run_rate(ping, target, rate, args, log_path):
+    if rate == "max":
+        count = args.max_count
+        mode = ["-B", "64"]
+    else:
+        count = max(1, int(int(rate) * args.duration))
+        mode = ["-p", rate]
+    cmd = [ping, target, *mode, "-c", str(count), "-s", str(args.size),
+           "-w", "1", "-r", "0", "-v", "0", "-l", log_path]
+
+    # CPU of the prober alone: user + system time of the finished child
+    before = resource.getrusage(resource.RUSAGE_CHILDREN)
+    result = subprocess.run(cmd, capture_output=True, text=True)
+    after = resource.getrusage(resource.RUSAGE_CHILDREN)
+    if result.returncode != 0:
+        print(result.stdout + result.stderr, file=sys.stderr)
+        return None
+    cpu = (after.ru_utime - before.ru_utime) + (after.ru_stime - before.ru_stime)
+
+    row = parse_output(result.stdout)
+    row["requested_pps"] = rate
+    row["cpu_us_per_probe"] = f"{cpu * 1e6 / row['sent']:.2f}" if row["sent"] else ""
+    return row
+
+
+def main():
+    parser = argparse.ArgumentParser(description="End-to-end throughput benchmark for enhanced_ping")
+    parser.add_argument("--responder", choices=["kernel", "reflector", "netns"], default="reflector")
+    parser.add_argument("--rates", default="1000,2000,5000,10000,20000,50000,100000,max",
+                        help="Comma-separated probe rates in pps; 'max' runs the batched flood")
+    parser.add_argument("--duration", type=float, default=5.0, help="Seconds per paced rate")
+    parser.add_argument("--max-count", type=int, default=500000, help="Probes in the 'max' run")
+    parser.add_argument("--size", type=int, default=56, help="Payload size (-s)")
+    parser.add_argument("--label", default=None, help="Row label (default: current commit)")
+    parser.add_argument("--out", default="e2e_results.csv", help="CSV to append to")
+    args = parser.parse_args()
+
+    if os.geteuid() != 0:
+        sys.exit("This script must be run as root to create raw sockets")
+    label = args.label or commit_label()
+    new_file = not os.path.exists(args.out)
+    with tempfile.TemporaryDirectory() as tmp:
+        ping = build("enhanced_ping", tmp)
+        proc, target = start_responder(args.responder, tmp)
+        try:
+            run_rates(ping, target, label, args, new_file, tmp)
+        finally:
+            stop_responder(proc)
+
+
+def run_rates(ping, target, label, args, new_file, tmp):
+    """Run each requested rate and append its row to the CSV."""
+    with open(args.out, "a", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=FIELDS)
+        if new_file:
+            writer.writeheader()
+        for rate in args.rates.split(","):
+            row = run_rate(ping, target, rate.strip(), args, os.path.join(tmp, "run.log"))
+            if row is None:
+                print(f"{rate} pps: enhanced_ping failed", file=sys.stderr)
+                continue
+            row.update(label=label, responder=args.responder, target=target, size=args.size)
+            writer.writerow(row)
+            f.flush()
+            print(f"{rate:>8} pps: achieved {row['achieved_pps']}, loss {row.get('loss_pct', '')}%, "
+                  f"{row['cpu_us_per_probe']} us CPU/probe, p50/p99 {row['rtt_p50_ms']}/{row['rtt_p99_ms']} ms")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,69 @@
+#!/bin/bash
+# Echo Reflector Lab
+# Puts echo_reflector alone in a network namespace at the far end of a veth
+# pair, with the namespace's kernel echo turned off, so enhanced_ping can be
+# pointed at REFLECTOR_IP without touching the host's own ICMP settings.
+# Arguments are passed to echo_reflector, e.g.:
+#   ./reflector_netns.sh -d 5:1 -l 1 -c 0.5
+# and, from another shell:
+#   ./enhanced_ping 10.200.0.2 -B 64 -c 100000 -v 0
+# Ctrl+C stops the reflector and removes the namespace.
+
+# Configuration Variables
+NETNS="ep_reflector"
+HOST_IF="ep-host"
+NS_IF="ep-refl"
+HOST_IP="10.200.0.1"
+REFLECTOR_IP="10.200.0.2"
+PREFIX=24
+
+# Check if the script is run as root
+if [ "$EUID" -ne 0 ]; then
+  echo "This script must be run as root to create namespaces and raw sockets"
+  exit 1
+fi
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+REPO_DIR="$(dirname "$SCRIPT_DIR")"
+
+# Use a prebuilt reflector if REFLECTOR names one, else compile it if not already compiled
+if [ -z "$REFLECTOR" ]; then
+  REFLECTOR="$REPO_DIR/echo_reflector"
+  if [ ! -f "$REFLECTOR" ]; then
+    echo "Compiling echo_reflector.c..."
+    gcc -O2 -o "$REFLECTOR" "$REPO_DIR/echo_reflector.c" -lm -pthread
+    if [ $? -ne 0 ]; then
+      echo "Failed to compile echo_reflector.c"
+      exit 1
+    fi
+  fi
+fi
+
+cleanup() {
+  ip link del $HOST_IF 2>/dev/null
+  ip netns del $NETNS 2>/dev/null
+}
+trap cleanup EXIT
+
+# Start from a clean slate in case an earlier run was killed
+cleanup
+ip netns add $NETNS || exit 1
+ip link add $HOST_IF type veth peer name $NS_IF || exit 1
+ip link set $NS_IF netns $NETNS
+ip addr add $HOST_IP/$PREFIX dev $HOST_IF
+ip link set $HOST_IF up
+ip netns exec $NETNS ip addr add $REFLECTOR_IP/$PREFIX dev $NS_IF
+ip netns exec $NETNS ip link set $NS_IF up
+ip netns exec $NETNS ip link set lo up
+
+# Only the reflector answers inside the namespace
+ip netns exec $NETNS sysctl -q -w net.ipv4.icmp_echo_ignore_all=1
+
+echo "Reflector at $REFLECTOR_IP (namespace $NETNS, host side $HOST_IF $HOST_IP)"
+ip netns exec $NETNS "$REFLECTOR" -I $NS_IF "$@" &
+REFLECTOR_PID=$!
+
+# Pass a stop on to the reflector so it prints its totals, then clean up
+trap 'kill -INT $REFLECTOR_PID 2>/dev/null' INT TERM
+wait $REFLECTOR_PID # Returns early when a signal is trapped
+wait $REFLECTOR_PID
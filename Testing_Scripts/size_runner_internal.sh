@@ -19,7 +19,7 @@ fi
 # Compile the ping tool if not already compiled
 if [ ! -f "./enhanced_ping" ]; then
   echo "Compiling enhanced_ping.c..."
-  gcc -o enhanced_ping enhanced_ping.c
+  gcc -O2 -o enhanced_ping enhanced_ping.c -lm -pthread
   if [ $? -ne 0 ]; then
     echo "Failed to compile enhanced_ping.c"
     exit 1
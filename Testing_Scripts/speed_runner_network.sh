@@ -18,7 +18,7 @@ if [ "$EUID" -ne 0 ]; then
 fi
 
 # Compile the ping tool
-gcc -o enhanced_ping enhanced_ping.c
+gcc -O2 -o enhanced_ping enhanced_ping.c -lm -pthread
 if [ $? -ne 0 ]; then
   echo "Failed to compile enhanced_ping.c"
   exit 1
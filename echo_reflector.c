@@ -0,0 +1,718 @@
+// Echo reflector for benchmarking enhanced_ping
+// Answers ICMP echo requests from user space so the responder is neither the
+// bottleneck nor host-dependent: the kernel's own replies are rate-limited
+// (icmp_ratelimit) and vary between machines. Requests are read and replies
+// written in batches with recvmmsg()/sendmmsg(), and replies can be delayed,
+// dropped or corrupted to exercise the prober's loss and [CORRUPTED] paths.
+// Meant to run alone in a network namespace at the far end of a veth pair
+// (see Testing_Scripts/reflector_netns.sh) with the kernel's echo turned off.
+//
+// Build: gcc -O2 -o echo_reflector echo_reflector.c -lm -pthread
+
+#define _GNU_SOURCE             // recvmmsg(), sendmmsg()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <arpa/inet.h>
+
+// From <linux/icmp.h>, which clashes with <netinet/ip_icmp.h>
+#ifndef ICMP_FILTER
+#define ICMP_FILTER 1
+struct icmp_filter {
+    uint32_t data;            // Bit set: drop that ICMP type
+};
+#endif
+
+// Define constants
+// -------------------------------------------------------------------
+#define MAX_PACKET      65536   // Largest IP datagram
+#define DEFAULT_BATCH   64      // Requests read per recvmmsg()
+#define MAX_BATCH       1024
+#define MAX_PENDING     65536   // Delayed replies held at once
+#define SLOT_SIZE       2048    // Pooled copy of a delayed reply; larger ones are malloc()ed
+#define RCVBUF_BYTES    (8 * 1024 * 1024)
+#define CONTROL_SIZE    64      // Room for one IP_PKTINFO control message
+#define ECHO_IGNORE_ALL "/proc/sys/net/ipv4/icmp_echo_ignore_all"
+
+// A reply waiting out its delay
+typedef struct {
+    uint64_t due_ns;
+    uint64_t order;           // Arrival order, so equal deadlines leave FIFO
+    struct sockaddr_in to;
+    struct in_addr from;      // Address the request was sent to, the reply's source
+    unsigned char *data;      // ICMP message
+    int len;
+} pending_reply_t;
+
+// Counters, printed every second and at exit
+typedef struct {
+    unsigned long long received;    // Echo requests read
+    unsigned long long replied;     // Replies handed to the kernel
+    unsigned long long lost;        // Dropped on purpose (-l)
+    unsigned long long corrupted;   // Corrupted on purpose (-c)
+    unsigned long long overflow;    // Dropped because the delay queue was full
+    unsigned long long send_errors; // Refused by sendmmsg()
+    unsigned long long malformed;   // Too short to be an echo request
+} reflector_stats_t;
+
+// Global variables
+volatile sig_atomic_t running = 1;
+int batch_size = DEFAULT_BATCH;
+double delay_ms = 0;
+double jitter_ms = 0;
+double loss_pct = 0;
+double corrupt_pct = 0;
+bool corrupt_stale = false;   // Leave the checksum as it was after corrupting
+bool quiet = false;
+uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+reflector_stats_t stats;
+
+pending_reply_t *pending;     // Min-heap on (due_ns, order)
+int pending_count = 0;
+uint64_t pending_order = 0;
+unsigned char *slot_pool;     // MAX_PENDING slots of SLOT_SIZE
+int *free_slots;              // Stack of free slot indices
+int free_slot_count = 0;
+
+// Handle signals (Ctrl+C)
+void signal_handler(int signo) {
+    (void)signo;
+    running = 0;
+}
+
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// xorshift64*: cheap, and repeatable for a given -r seed
+uint64_t next_random(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+// Uniform in [0, 1)
+double random_unit(void) {
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+bool chance(double pct) {
+    return pct > 0 && random_unit() * 100.0 < pct;
+}
+
+// Checksums
+// -------------------------------------------------------------------
+// A reply differs from its request in the type byte and, when corrupted, in
+// one payload byte, so its checksum is patched rather than recomputed.
+
+// Fold a one's-complement sum to 16 bits and complement it
+unsigned short checksum_fold(uint64_t sum) {
+    while (sum >> 16) {
+        sum = (sum >> 16) + (sum & 0xFFFF);
+    }
+    return (unsigned short)(~sum);
+}
+
+// Update a checksum for one 16-bit word changing (RFC 1624, eqn. 3)
+unsigned short checksum_adjust(unsigned short checksum, unsigned short old_word, unsigned short new_word) {
+    uint64_t sum = (unsigned short)~checksum;
+    sum += (unsigned short)~old_word + new_word;
+    return checksum_fold(sum);
+}
+
+// Replace the 16-bit word at an even offset of the ICMP message, patching
+// the checksum unless told to leave it stale
+void rewrite_word(unsigned char *icmp, int offset, unsigned short new_word, bool fix_checksum) {
+    struct icmphdr *hdr = (struct icmphdr *)icmp;
+    unsigned short old_word;
+    memcpy(&old_word, icmp + offset, sizeof(old_word));
+    memcpy(icmp + offset, &new_word, sizeof(new_word));
+    if (fix_checksum) {
+        hdr->checksum = checksum_adjust(hdr->checksum, old_word, new_word);
+    }
+}
+
+// Impairments
+// -------------------------------------------------------------------
+
+// Flip one bit past the echoed timestamp, where enhanced_ping checks its
+// pattern, so the reply still matches its probe but fails the payload check.
+// Returns false if the payload holds nothing past the timestamp.
+bool corrupt_payload(unsigned char *icmp, int len) {
+    int start = sizeof(struct icmphdr) + sizeof(struct timeval);
+    if (len <= start) {
+        return false;
+    }
+    int offset = start + (int)(next_random() % (uint64_t)(len - start));
+    int word = offset & ~1;
+    unsigned char bytes[2] = {icmp[word], word + 1 < len ? icmp[word + 1] : 0};
+    bytes[offset - word] ^= 1 << (next_random() & 7);
+
+    unsigned short new_word;
+    memcpy(&new_word, bytes, sizeof(new_word));
+    if (word + 1 < len) {
+        rewrite_word(icmp, word, new_word, !corrupt_stale);
+    } else {
+        // Odd trailing byte: summed as if padded with a zero byte
+        unsigned short old_word;
+        unsigned char old_bytes[2] = {icmp[word], 0};
+        memcpy(&old_word, old_bytes, sizeof(old_word));
+        icmp[word] = bytes[0];
+        if (!corrupt_stale) {
+            struct icmphdr *hdr = (struct icmphdr *)icmp;
+            hdr->checksum = checksum_adjust(hdr->checksum, old_word, new_word);
+        }
+    }
+    return true;
+}
+
+// Turn an echo request into its reply in place
+void make_reply(unsigned char *icmp) {
+    unsigned short type_code;
+    unsigned char bytes[2] = {ICMP_ECHOREPLY, icmp[1]};
+    memcpy(&type_code, bytes, sizeof(type_code));
+    rewrite_word(icmp, 0, type_code, true);
+}
+
+// Reply delay
+double reply_delay_ms(void) {
+    double d = delay_ms;
+    if (jitter_ms > 0) {
+        d += (random_unit() * 2.0 - 1.0) * jitter_ms;
+    }
+    return d > 0 ? d : 0;
+}
+
+// Delay queue
+// -------------------------------------------------------------------
+// Delayed replies are copied out of the receive batch into pooled slots and
+// kept in a binary min-heap on their deadline; with jitter they leave in
+// deadline order, i.e. reordered as on a real path.
+
+bool pending_before(const pending_reply_t *a, const pending_reply_t *b) {
+    return a->due_ns < b->due_ns || (a->due_ns == b->due_ns && a->order < b->order);
+}
+
+bool init_pending(void) {
+    pending = malloc(MAX_PENDING * sizeof(pending_reply_t));
+    slot_pool = malloc((size_t)MAX_PENDING * SLOT_SIZE);
+    free_slots = malloc(MAX_PENDING * sizeof(int));
+    if (!pending || !slot_pool || !free_slots) {
+        return false;
+    }
+    for (int i = MAX_PENDING - 1; i >= 0; i--) {
+        free_slots[free_slot_count++] = i;
+    }
+    return true;
+}
+
+// Copy a reply into the queue, due at due_ns
+bool push_pending(const unsigned char *icmp, int len, const struct sockaddr_in *to, struct in_addr from,
+                  uint64_t due_ns) {
+    if (pending_count == MAX_PENDING) {
+        return false;
+    }
+    unsigned char *data;
+    if (len <= SLOT_SIZE) {
+        data = slot_pool + (size_t)free_slots[--free_slot_count] * SLOT_SIZE;
+    } else if (!(data = malloc(len))) {
+        return false;
+    }
+    memcpy(data, icmp, len);
+
+    pending_reply_t r = {due_ns, pending_order++, *to, from, data, len};
+    int i = pending_count++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!pending_before(&r, &pending[parent])) {
+            break;
+        }
+        pending[i] = pending[parent];
+        i = parent;
+    }
+    pending[i] = r;
+    return true;
+}
+
+// Remove the earliest reply from the heap (its buffer stays with the caller)
+pending_reply_t pop_pending(void) {
+    pending_reply_t top = pending[0];
+    pending_reply_t last = pending[--pending_count];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= pending_count) {
+            break;
+        }
+        if (child + 1 < pending_count && pending_before(&pending[child + 1], &pending[child])) {
+            child++;
+        }
+        if (!pending_before(&pending[child], &last)) {
+            break;
+        }
+        pending[i] = pending[child];
+        i = child;
+    }
+    if (pending_count > 0) {
+        pending[i] = last;
+    }
+    return top;
+}
+
+// Return a sent reply's buffer
+void release_pending(pending_reply_t *r) {
+    if (r->data >= slot_pool && r->data < slot_pool + (size_t)MAX_PENDING * SLOT_SIZE) {
+        free_slots[free_slot_count++] = (int)((r->data - slot_pool) / SLOT_SIZE);
+    } else {
+        free(r->data);
+    }
+}
+
+// Sending
+// -------------------------------------------------------------------
+// Replies from the receive batch (pointing into its buffers) and due delayed
+// replies are gathered into one sendmmsg() batch. Each carries an IP_PKTINFO
+// source, so a host with several addresses answers from the one that was
+// probed rather than the one the route prefers.
+
+typedef struct {
+    struct mmsghdr msgs[MAX_BATCH];
+    struct iovec iov[MAX_BATCH];
+    struct sockaddr_in to[MAX_BATCH];
+    union {
+        unsigned char buf[CMSG_SPACE(sizeof(struct in_pktinfo))];
+        struct cmsghdr align;
+    } control[MAX_BATCH];
+    pending_reply_t held[MAX_BATCH];  // Delayed replies to release once sent
+    int count;
+    int held_count;
+} send_batch_t;
+
+void flush_batch(int sock, send_batch_t *b) {
+    int done = 0;
+    while (done < b->count) {
+        int n = sendmmsg(sock, b->msgs + done, b->count - done, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Skip the reply the kernel refused (e.g. ENOBUFS) and go on
+            stats.send_errors++;
+            done++;
+            continue;
+        }
+        stats.replied += n;
+        done += n;
+    }
+    for (int i = 0; i < b->held_count; i++) {
+        release_pending(&b->held[i]);
+    }
+    b->count = 0;
+    b->held_count = 0;
+}
+
+void queue_send(int sock, send_batch_t *b, unsigned char *icmp, int len, const struct sockaddr_in *to,
+                struct in_addr from) {
+    if (b->count == MAX_BATCH) {
+        flush_batch(sock, b);
+    }
+    int i = b->count++;
+    b->to[i] = *to;
+    b->iov[i].iov_base = icmp;
+    b->iov[i].iov_len = len;
+    memset(&b->msgs[i].msg_hdr, 0, sizeof(b->msgs[i].msg_hdr));
+    b->msgs[i].msg_hdr.msg_name = &b->to[i];
+    b->msgs[i].msg_hdr.msg_namelen = sizeof(b->to[i]);
+    b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+    b->msgs[i].msg_hdr.msg_iovlen = 1;
+
+    // Multicast requests (and any without IP_PKTINFO) leave the source to the kernel
+    if (from.s_addr != INADDR_ANY && !IN_MULTICAST(ntohl(from.s_addr))) {
+        struct msghdr *msg = &b->msgs[i].msg_hdr;
+        msg->msg_control = b->control[i].buf;
+        msg->msg_controllen = sizeof(b->control[i].buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+        cmsg->cmsg_level = IPPROTO_IP;
+        cmsg->cmsg_type = IP_PKTINFO;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+        struct in_pktinfo pktinfo = { .ipi_spec_dst = from };
+        memcpy(CMSG_DATA(cmsg), &pktinfo, sizeof(pktinfo));
+    }
+}
+
+// Destination address of a received request, from its IP_PKTINFO (INADDR_ANY if none)
+struct in_addr request_dest(struct msghdr *msg) {
+    struct in_addr dest = { INADDR_ANY };
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+            struct in_pktinfo pktinfo;
+            memcpy(&pktinfo, CMSG_DATA(cmsg), sizeof(pktinfo));
+            dest = pktinfo.ipi_addr;
+        }
+    }
+    return dest;
+}
+
+// Queue every delayed reply that is due by now
+void send_due(int sock, send_batch_t *b, uint64_t now) {
+    while (pending_count > 0 && pending[0].due_ns <= now) {
+        if (b->held_count == MAX_BATCH) {
+            flush_batch(sock, b);
+        }
+        pending_reply_t r = pop_pending();
+        b->held[b->held_count++] = r;
+        queue_send(sock, b, r.data, r.len, &r.to, r.from);
+    }
+}
+
+// Socket setup
+// -------------------------------------------------------------------
+
+// Raw ICMP socket that only sees echo requests: the kernel's ICMP_FILTER
+// drops every other type before it is queued. IP_PKTINFO tells us which of
+// our addresses each request was sent to.
+int open_reflector_socket(const char *ifname) {
+    int sock = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+    if (sock < 0) {
+        perror("Socket creation failed (root or CAP_NET_RAW required)");
+        return -1;
+    }
+
+    struct icmp_filter filter = {~(1U << ICMP_ECHO)};
+    if (setsockopt(sock, SOL_RAW, ICMP_FILTER, &filter, sizeof(filter)) < 0) {
+        perror("Failed to set ICMP filter");
+    }
+
+    int on = 1;
+    if (setsockopt(sock, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on)) < 0) {
+        perror("Failed to enable IP_PKTINFO");
+        close(sock);
+        return -1;
+    }
+
+    int rcvbuf = RCVBUF_BYTES;
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0) {
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+
+    if (ifname && setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, ifname, strlen(ifname) + 1) < 0) {
+        perror("Failed to bind to interface");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Read or write net.ipv4.icmp_echo_ignore_all of this namespace
+int read_echo_ignore(void) {
+    FILE *f = fopen(ECHO_IGNORE_ALL, "r");
+    int value = -1;
+    if (f) {
+        if (fscanf(f, "%d", &value) != 1) {
+            value = -1;
+        }
+        fclose(f);
+    }
+    return value;
+}
+
+bool write_echo_ignore(int value) {
+    FILE *f = fopen(ECHO_IGNORE_ALL, "w");
+    if (!f) {
+        return false;
+    }
+    bool ok = fprintf(f, "%d\n", value) > 0;
+    return fclose(f) == 0 && ok;
+}
+
+// Statistics
+// -------------------------------------------------------------------
+
+// Rates over the last report interval, running totals of the impairments
+void print_rate(double elapsed, double interval, const reflector_stats_t *last) {
+    printf("%8.1f s  rx %9.0f pps  tx %9.0f pps  lost %llu  corrupted %llu  queued %d",
+           elapsed, (stats.received - last->received) / interval, (stats.replied - last->replied) / interval,
+           stats.lost, stats.corrupted, pending_count);
+    if (stats.overflow > 0 || stats.send_errors > 0) {
+        printf("  overflow %llu  send errors %llu", stats.overflow, stats.send_errors);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+void print_totals(double elapsed) {
+    printf("\n--- Reflector Statistics ---\n");
+    printf("%llu echo requests received, %llu replies sent in %.1f s (%.0f pps)\n",
+           stats.received, stats.replied, elapsed, elapsed > 0 ? stats.replied / elapsed : 0);
+    printf("%llu dropped on purpose, %llu corrupted, %llu still queued\n",
+           stats.lost, stats.corrupted, (unsigned long long)pending_count);
+    if (stats.overflow > 0 || stats.send_errors > 0 || stats.malformed > 0) {
+        printf("%llu delay queue overflows, %llu send errors, %llu malformed requests\n",
+               stats.overflow, stats.send_errors, stats.malformed);
+    }
+}
+
+// Print usage information
+void print_usage(char *prog_name) {
+    fprintf(stderr, "Usage: %s [options]\n", prog_name);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -I <interface>        Only answer requests arriving on this interface\n");
+    fprintf(stderr, "  -b <batch>            Requests read per recvmmsg() (default: %d, max: %d)\n",
+            DEFAULT_BATCH, MAX_BATCH);
+    fprintf(stderr, "  -d <ms>[:<jitter>]    Delay replies by ms, +/- a uniform jitter in ms\n");
+    fprintf(stderr, "  -l <percent>          Drop this share of replies\n");
+    fprintf(stderr, "  -c <percent>[:stale]  Flip a payload bit in this share of replies; with :stale\n");
+    fprintf(stderr, "                        the checksum is left unpatched as well\n");
+    fprintf(stderr, "  -r <seed>             Seed for loss, corruption and jitter (repeatable runs)\n");
+    fprintf(stderr, "  -k                    Turn off the kernel's echo replies in this namespace\n");
+    fprintf(stderr, "                        while running (net.ipv4.icmp_echo_ignore_all)\n");
+    fprintf(stderr, "  -q                    No per-second rates, totals only\n");
+    fprintf(stderr, "  -h                    Show this help message\n");
+}
+
+bool parse_percent(const char *arg, double *out) {
+    char *end;
+    double v = strtod(arg, &end);
+    if (end == arg || v < 0 || v > 100) {
+        fprintf(stderr, "Invalid percentage '%s'. Must be between 0 and 100.\n", arg);
+        return false;
+    }
+    *out = v;
+    return *end == '\0' || *end == ':';
+}
+
+// Main function
+// -------------------------------------------------------------------
+int main(int argc, char *argv[]) {
+    char *ifname = NULL;
+    bool silence_kernel = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "I:b:d:l:c:r:kqh")) != -1) {
+        switch (opt) {
+            case 'I':
+                ifname = optarg;
+                if (strlen(ifname) >= IFNAMSIZ) {
+                    fprintf(stderr, "Interface name too long.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b':
+                batch_size = atoi(optarg);
+                if (batch_size < 1 || batch_size > MAX_BATCH) {
+                    fprintf(stderr, "Invalid batch size. Must be between 1 and %d.\n", MAX_BATCH);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'd': {
+                char *end;
+                delay_ms = strtod(optarg, &end);
+                if (*end == ':') {
+                    jitter_ms = strtod(end + 1, &end);
+                }
+                if (*end != '\0' || delay_ms < 0 || jitter_ms < 0) {
+                    fprintf(stderr, "Invalid delay. Use <ms>[:<jitter ms>] with non-negative values.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'l':
+                if (!parse_percent(optarg, &loss_pct) || strchr(optarg, ':')) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'c': {
+                char *mode = strchr(optarg, ':');
+                if (!parse_percent(optarg, &corrupt_pct)) {
+                    return EXIT_FAILURE;
+                }
+                if (mode && strcmp(mode, ":stale") != 0) {
+                    fprintf(stderr, "Invalid corruption mode '%s'. Only :stale is known.\n", mode + 1);
+                    return EXIT_FAILURE;
+                }
+                corrupt_stale = mode != NULL;
+                break;
+            }
+            case 'r':
+                rng_state = strtoull(optarg, NULL, 0);
+                if (rng_state == 0) {
+                    rng_state = 1; // xorshift never leaves 0
+                }
+                break;
+            case 'k':
+                silence_kernel = true;
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int sock = open_reflector_socket(ifname);
+    if (sock < 0) {
+        return EXIT_FAILURE;
+    }
+    bool delaying = delay_ms > 0 || jitter_ms > 0;
+    if (delaying && !init_pending()) {
+        perror("Failed to allocate delay queue");
+        return EXIT_FAILURE;
+    }
+
+    // One receive buffer per batch slot; only touched as far as requests reach
+    unsigned char *bufs = malloc((size_t)batch_size * MAX_PACKET);
+    struct mmsghdr *msgs = calloc(batch_size, sizeof(struct mmsghdr));
+    struct iovec *iov = calloc(batch_size, sizeof(struct iovec));
+    struct sockaddr_in *from = calloc(batch_size, sizeof(struct sockaddr_in));
+    unsigned char *controls = malloc((size_t)batch_size * CONTROL_SIZE);
+    send_batch_t *out = calloc(1, sizeof(send_batch_t));
+    if (!bufs || !msgs || !iov || !from || !controls || !out) {
+        perror("Failed to allocate batch buffers");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < batch_size; i++) {
+        iov[i].iov_base = bufs + (size_t)i * MAX_PACKET;
+        iov[i].iov_len = MAX_PACKET;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &from[i];
+        msgs[i].msg_hdr.msg_control = controls + (size_t)i * CONTROL_SIZE;
+    }
+
+    int saved_ignore = -1;
+    if (silence_kernel) {
+        saved_ignore = read_echo_ignore();
+        if (!write_echo_ignore(1)) {
+            perror("Failed to set " ECHO_IGNORE_ALL);
+            return EXIT_FAILURE;
+        }
+    } else if (read_echo_ignore() == 0) {
+        fprintf(stderr, "Warning: the kernel answers echo requests here too, so the prober will see "
+                        "duplicate replies. Use -k or run in a namespace with it off.\n");
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = signal_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("Reflecting echo requests%s%s, batch %d", ifname ? " on " : "", ifname ? ifname : "", batch_size);
+    if (delaying) printf(", delay %.3f ms +/- %.3f ms", delay_ms, jitter_ms);
+    if (loss_pct > 0) printf(", loss %.2f%%", loss_pct);
+    if (corrupt_pct > 0) printf(", corruption %.2f%%%s", corrupt_pct, corrupt_stale ? " (stale checksum)" : "");
+    printf("\n");
+    fflush(stdout);
+
+    uint64_t start_ns = now_ns();
+    uint64_t last_report_ns = start_ns;
+    uint64_t next_report_ns = start_ns + 1000000000ULL;
+    reflector_stats_t last = stats;
+    struct pollfd pfd = {sock, POLLIN, 0};
+
+    while (running) {
+        // Sleep until a request arrives, a delayed reply is due or it's time to report
+        uint64_t now = now_ns();
+        uint64_t wake = next_report_ns;
+        if (pending_count > 0 && pending[0].due_ns < wake) {
+            wake = pending[0].due_ns;
+        }
+        if (wake > now) {
+            struct timespec ts = {(wake - now) / 1000000000ULL, (wake - now) % 1000000000ULL};
+            if (ppoll(&pfd, 1, &ts, NULL) < 0 && errno != EINTR) {
+                perror("ppoll");
+                break;
+            }
+        }
+
+        for (int i = 0; i < batch_size; i++) {
+            msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+            msgs[i].msg_hdr.msg_controllen = CONTROL_SIZE;
+        }
+        int n = recvmmsg(sock, msgs, batch_size, MSG_DONTWAIT, NULL);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            perror("recvmmsg");
+            break;
+        }
+        now = now_ns();
+
+        for (int i = 0; i < n; i++) {
+            unsigned char *packet = iov[i].iov_base;
+            int len = msgs[i].msg_len;
+            struct iphdr *ip = (struct iphdr *)packet;
+            int ip_len = len >= (int)sizeof(struct iphdr) ? ip->ihl * 4 : len;
+            int icmp_len = len - ip_len;
+            unsigned char *icmp = packet + ip_len;
+            if (icmp_len < (int)sizeof(struct icmphdr) || icmp[0] != ICMP_ECHO || icmp[1] != 0) {
+                stats.malformed++;
+                continue;
+            }
+            stats.received++;
+
+            if (chance(loss_pct)) {
+                stats.lost++;
+                continue;
+            }
+            make_reply(icmp);
+            if (chance(corrupt_pct) && corrupt_payload(icmp, icmp_len)) {
+                stats.corrupted++;
+            }
+
+            struct in_addr dest = request_dest(&msgs[i].msg_hdr);
+            if (delaying) {
+                uint64_t due = now + (uint64_t)(reply_delay_ms() * 1e6);
+                if (!push_pending(icmp, icmp_len, &from[i], dest, due)) {
+                    stats.overflow++;
+                }
+            } else {
+                queue_send(sock, out, icmp, icmp_len, &from[i], dest);
+            }
+        }
+        send_due(sock, out, now);
+        flush_batch(sock, out);
+
+        if (now >= next_report_ns) {
+            if (!quiet) {
+                print_rate((now - start_ns) / 1e9, (now - last_report_ns) / 1e9, &last);
+            }
+            last = stats;
+            last_report_ns = now;
+            next_report_ns += 1000000000ULL;
+            if (next_report_ns <= now) {
+                next_report_ns = now + 1000000000ULL;
+            }
+        }
+    }
+
+    print_totals((now_ns() - start_ns) / 1e9);
+    if (silence_kernel && saved_ignore >= 0 && !write_echo_ignore(saved_ignore)) {
+        perror("Failed to restore " ECHO_IGNORE_ALL);
+    }
+    close(sock);
+    return EXIT_SUCCESS;
+}
@@ -4,6 +4,8 @@
 // Fixed version by Claude to address packet reception issues
 //
 
+#define _GNU_SOURCE             // sendmmsg() / recvmmsg()
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,6 +22,30 @@
 #include <stdarg.h>
 #include <time.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <pthread.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 // Define constants
 // -------------------------------------------------------------------
@@ -30,7 +56,49 @@
 #define DEFAULT_COUNT   -1      // Default ping count (-1 means infinite)
 #define MAX_RETRY       3       // Maximum retry attempts per packet
 #define RETRY_INTERVAL  500     // Time between retries (milliseconds)
-#define MAX_HISTORY     1000    // Maximum history size for tracking packets
+#define RTO_INITIAL_MS  1000    // Adaptive timeout before the first RTT sample (RFC 6298)
+#define HISTORY_SIZE    65536   // Packet history ring slots (power of two, >= 2 * MAX_WINDOW)
+#define MAX_WINDOW      32768   // Maximum probes in flight in pipelined mode (half the 16-bit sequence space)
+#define WHEEL_BITS      6       // Timer wheel: 64 buckets per level
+#define WHEEL_LEVELS    7       // Timer wheel: 1 us ticks, 7 levels span 2^42 us (~51 days)
+#define MAX_BATCH       1024    // Maximum probes per sendmmsg()/recvmmsg() in batch mode
+#define MAX_THREADS     64      // Maximum flood worker threads
+#define MAX_SWEEP_VALUES 64    // Most values per key (targets, sizes, ...) in a sweep spec
+#define MAX_FILTER_SOURCES 64   // Largest target set the socket filter matches by source address
+#define RX_RING_BLOCK_SIZE (1 << 20) // TPACKET_V3 ring: bytes per block
+#define RX_RING_BLOCKS  64      // TPACKET_V3 ring: blocks (64 MB in all)
+#define RX_RING_BLOCK_TIMEOUT 10 // TPACKET_V3 ring: ms before a partly filled block is handed over
+#define PACE_SPIN_NS    100000  // Paced mode busy-waits instead of sleeping for gaps below 100 us
+#define PACE_LATE_NS    100000  // Paced mode counts sends more than 100 us behind schedule as late
+#define PACE_WINDOW     256     // Paced mode's default in-flight window
+#define STALL_NS        20000   // Low-jitter mode: a busy-poll pass slower than 20 us is a stall of the prober
+#define BUSY_POLL_US    50      // Low-jitter mode: SO_BUSY_POLL budget per receive
+#define PREFAULT_STACK  (512 * 1024) // Low-jitter mode: stack bytes touched up front
+#define LOG_RING_EVENTS 8192    // Async logger ring slots (power of two)
+#define LOG_EVENT_TEXT  120     // Async logger: text bytes per event
+#define LOG_LINE_MAX    1024    // Longest log line
+#define LOG_FLUSH_BYTES 65536   // Async logger writes once this much output is pending...
+#define LOG_FLUSH_MS    100     // ...or the oldest pending line is this old
+#define FLOOD_LOG_EVENTS 1024   // Corrupt replies a flood worker queues for the main thread to log
+#define METRICS_PUBLISH_NS 100000000LL // Stats are republished for the exporter every 100 ms
+#define METRICS_BODY_MAX 16384  // Largest /metrics response body
+#define URING_ENTRIES   256     // io_uring submission queue depth
+#define URING_BUFFERS   256     // io_uring provided receive buffers (power of two)
+#define URING_SEND_BUFS 64      // io_uring probe copies awaiting send completion
+#define URING_BGID      1       // io_uring provided-buffer group ID
+#define URING_UD_RECV    1      // io_uring user_data tags (low byte)
+#define URING_UD_SEND    2
+#define URING_UD_TIMEOUT 3
+#define HIST_SUB_BITS   5       // Latency histogram: 32 linear sub-buckets per power of two (~3%)
+#define HIST_MAX_EXP    40      // Latency histogram: track RTTs up to 2^40 ns (~18 minutes)
+#define HIST_BUCKETS    ((HIST_MAX_EXP - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+// Log verbosity levels; the log file always gets everything
+enum {
+    LOG_SUMMARY,              // Headers, summaries and statistics
+    LOG_EVENTS,               // Also timeouts, retries and ICMP errors
+    LOG_REPLIES               // Also a line per reply (default)
+};
 
 // Experiment modes
 typedef enum {
@@ -39,121 +107,562 @@ typedef enum {
     MODE_INTERMITTENT     // Random intervals between pings
 } experiment_mode_t;
 
+// How reply payloads are checked for corruption
+typedef enum {
+    INTEGRITY_PATTERN,    // Compare against the i & 0xFF pattern
+    INTEGRITY_CRC32C      // Check the CRC32C the sender embedded after the timestamp (-C)
+} integrity_mode_t;
+
 // Packet status tracking
 typedef struct {
+    bool in_use;              // Slot has held a probe
     int seq_num;              // Sequence number
-    struct timeval sent_time; // Time when packet was sent
+    long long sent_ns;        // Time of the latest transmission (CLOCK_MONOTONIC)
+    long long tx_ns;          // Latest TX timestamp (CLOCK_REALTIME ns), kernel timestamp mode only
     int retries;              // Number of retries for this packet
     bool received;            // Whether packet was received
     double rtt;               // Round trip time in ms
     bool corrupted;           // Whether received packet was corrupted
+    unsigned short reply_len; // ICMP bytes in the reply
+    unsigned char ttl;        // TTL of the reply
+    unsigned char icmp_error; // ICMP error type reported for this probe, 0 if none
 } packet_history_t;
 
+// Timer wheel entry, embedded in whatever it times
+typedef struct wheel_timer {
+    struct wheel_timer *next; // Bucket list; NULL when not scheduled
+    struct wheel_timer *prev;
+    long long expires;        // Expiry tick (us since the wheel started)
+} wheel_timer_t;
+
+// Hierarchical timer wheel: level l holds timers that agree with `now` in
+// every digit above l and expire in bucket l's digit
+typedef struct {
+    wheel_timer_t buckets[WHEEL_LEVELS][1 << WHEEL_BITS]; // Circular list heads
+    uint64_t occupied[WHEEL_LEVELS]; // Non-empty buckets per level
+    long long origin_us;      // Start time (CLOCK_MONOTONIC us) of tick 0
+    long long now;            // Next tick to process; everything before it has fired
+    int count;                // Timers scheduled
+} timer_wheel_t;
+
+// In-flight probe slot for pipelined mode (indexed by seq % window)
+typedef struct {
+    bool active;              // Slot holds an unanswered probe
+    bool awaiting_retry;      // Timed out, waiting for the retry gap before resend
+    int seq_num;              // Sequence number of the probe in this slot
+    int tries;                // Transmissions so far
+    long long sent_ns;        // Time of the latest transmission (CLOCK_MONOTONIC)
+    unsigned char stamp[sizeof(struct timeval)]; // Payload timestamp of the latest transmission
+    long long intended_ns;    // When the schedule wanted the first transmission
+    wheel_timer_t timer;      // Timeout or retry time for this slot
+} inflight_slot_t;
+
+// Pipelined engine state, shared by the select() and io_uring backends
+typedef struct {
+    inflight_slot_t *slots;   // In-flight window, indexed by seq % window
+    int window;               // Maximum probes in flight
+    char *packet;             // Scratch buffer probes are built in
+    int packet_size;
+    int count;                // Probes to send (-1 = infinite)
+    long long period_ns;      // Gap between new probes
+    bool open_loop;           // Paced (-p): keep to the schedule, RTT from the intended send time
+    int timeout;              // Reply timeout (seconds)
+    int retries;              // Retries per probe
+    int seq_num;              // Next new sequence number
+    long long next_send_ns;   // When the next new probe is due (CLOCK_MONOTONIC)
+    long long first_send_ns;  // Actual times of the first and latest new probe
+    long long last_send_ns;
+    int late_count;           // Open loop: probes sent more than PACE_LATE_NS behind schedule
+    long long max_late_ns;    // Open loop: worst lateness
+    timer_wheel_t wheel;      // Timeouts and retries of the active slots
+    int in_flight;            // Active slots
+    long long (*transmit)(char *packet, int packet_size, int seq_num); // Hands a built probe to the kernel
+} pipeline_t;
+
+// Streaming RTT statistics: log-bucketed histogram plus running moments
+typedef struct {
+    uint64_t buckets[HIST_BUCKETS]; // Reply counts per log-linear RTT bucket (ns)
+    uint64_t count;                 // Replies recorded
+    double min;                     // Smallest RTT in ms
+    double max;                     // Largest RTT in ms
+    double mean;                    // Running mean in ms (Welford)
+    double m2;                      // Sum of squared deviations from the mean
+    double jitter;                  // RFC 3550 inter-arrival jitter in ms
+    double last_rtt;                // Previous RTT, for the jitter estimate
+} latency_hist_t;
+
+// Run counters and RTT distribution (one per target in multi-target mode)
+typedef struct {
+    int send_count;           // Total packets sent (including retries)
+    int original_send_count;  // Original packets sent (excluding retries)
+    int recv_count;           // Total packets received
+    int resend_count;         // Number of packets resent
+    int rereceived_count;     // Number of packets received after retry
+    int corrupt_count;        // Number of corrupted packets detected
+    latency_hist_t rtt;       // RTT distribution over all uncorrupted replies
+} ping_stats_t;
+
+// Constant part of the echo payload for one packet size: what follows the
+// timestamp (the integrity pattern, led by its CRC32C in -C mode), and its
+// checksum contribution
+typedef struct {
+    int packet_size;          // Packet size the template was built for (0 = none yet)
+    integrity_mode_t mode;    // Integrity mode the template was built for
+    unsigned char *pattern;   // Pattern bytes following the timestamp
+    int pattern_len;
+    uint64_t pattern_sum;     // Unfolded one's-complement sum of the pattern
+} payload_template_t;
+
+// One run of the single-target engines: what main() and each sweep cell
+// hand to run_experiment()
+typedef struct {
+    int packet_size;
+    int count;                // -1 = until interrupted
+    int interval;             // ms
+    int timeout;              // s
+    int retries;
+    int window;               // 0 = stop-and-wait
+    int batch;                // 0 = no batching
+    bool use_uring;
+    bool use_ring;
+    int threads;              // 0 = single-threaded
+    int ttl;
+    double pps;               // 0 = closed loop
+} experiment_t;
+
+// The prober's own timing noise: how late probes leave against their
+// schedule and, in low-jitter mode, how long the polling loop stalls
+typedef struct {
+    latency_hist_t send_late; // Actual minus intended send time of new probes
+    uint64_t stalls;          // Busy-poll passes slower than STALL_NS
+    long long max_stall_ns;   // Longest of them
+    int stalled_replies;      // Stop-and-wait replies whose wait included a stall
+} sched_noise_t;
+
+// Retransmission timeout: either the fixed -w timeout, or with -A an RFC 6298
+// estimate from the smoothed RTT and its variance, backed off per retry
+typedef struct {
+    bool adaptive;
+    bool have_sample;         // SRTT and RTTVAR hold a measurement
+    double srtt;              // Smoothed RTT (ms)
+    double rttvar;            // RTT variance estimate (ms)
+    double rto;               // Timeout for a first transmission (ms)
+    double min_rto, max_rto;  // Bounds (ms): the -A floor and the -w timeout
+    latency_hist_t armed;     // Timeouts actually waited per transmission, after backoff
+    int answered_retries;     // Retried probes that got a reply
+    int spurious_retries;     // ...where the reply answered an earlier transmission
+} rto_state_t;
+
 // Global variables for the program
 int sockfd;
-int send_count = 0;           // Total packets sent (including retries)
-int original_send_count = 0;  // Original packets sent (excluding retries)
-int recv_count = 0;           // Total packets received
-int resend_count = 0;         // Number of packets resent
-int rereceived_count = 0;     // Number of packets received after retry
-int corrupt_count = 0;        // Number of corrupted packets detected
-int stop_ping = 0;
+ping_stats_t stats;           // Run counters and RTT distribution
+volatile int stop_ping = 0;  // Set by SIGINT; every engine ends its loop and main() reports
 struct sockaddr_in dest_addr;
-packet_history_t packet_history[MAX_HISTORY];
-int total_packets = 0;
+packet_history_t packet_history[HISTORY_SIZE];  // Ring indexed by seq % HISTORY_SIZE
+int highest_seq = -1;         // Newest sequence number added to the history
 char *logfile_name = NULL;    // Log file name
 FILE *logfile = NULL;         // Log file pointer
+bool log_to_stdout = true;    // Sweep cells write their output to the log file only
+int stdout_verbosity = LOG_REPLIES;  // Most detailed lines shown on stdout (-v)
 experiment_mode_t mode = MODE_STANDARD;  // Default mode
+integrity_mode_t integrity_mode = INTEGRITY_PATTERN;  // Payload corruption check
 unsigned short ident;         // Identifier for our ICMP packets
+bool kernel_timestamps = false;  // Take RTTs from kernel RX/TX timestamps (-T)
+bool dgram_socket = false;    // Probe over an unprivileged ICMP datagram socket (-d)
+bool kernel_tx_timestamps = false;  // Kernel also reports TX timestamps on the error queue
+unsigned int tx_id_next = 0;  // SOF_TIMESTAMPING_OPT_ID of the next successful send
+int tx_id_seq[HISTORY_SIZE];  // Sequence number sent under each OPT_ID
+payload_template_t payload_template;  // Payload of the current packet size
+bool low_jitter = false;      // Busy-poll instead of sleeping in select() (-J)
+sched_noise_t sched_noise;    // Send lateness and polling stalls of the current run
+long long probe_stall_ns;     // Longest stall while waiting for the current probe
+double rto_min_ms = 0;        // -A: adaptive timeout floor (0 = fixed -w timeout)
+rto_state_t rto;              // Timeout estimator of the current run
+
+// Payload comparison
+// -------------------------------------------------------------------
+// True if the `len` bytes at a and b differ. The vector versions OR together
+// the XOR of every block and test once at the end: replies are nearly always
+// intact, so there is no early exit to branch on.
+bool payload_differs_scalar(const unsigned char *a, const unsigned char *b, int len) {
+    return memcmp(a, b, len) != 0;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+bool payload_differs_sse2(const unsigned char *a, const unsigned char *b, int len) {
+    __m128i diff0 = _mm_setzero_si128(), diff1 = _mm_setzero_si128();
+    int i = 0;
+
+    // Two independent accumulators, 32 bytes per step
+    for (; i + 32 <= len; i += 32) {
+        diff0 = _mm_or_si128(diff0, _mm_xor_si128(_mm_loadu_si128((const __m128i *)(a + i)),
+                                                  _mm_loadu_si128((const __m128i *)(b + i))));
+        diff1 = _mm_or_si128(diff1, _mm_xor_si128(_mm_loadu_si128((const __m128i *)(a + i + 16)),
+                                                  _mm_loadu_si128((const __m128i *)(b + i + 16))));
+    }
+    for (; i + 16 <= len; i += 16) {
+        diff0 = _mm_or_si128(diff0, _mm_xor_si128(_mm_loadu_si128((const __m128i *)(a + i)),
+                                                  _mm_loadu_si128((const __m128i *)(b + i))));
+    }
+    __m128i diff = _mm_or_si128(diff0, diff1);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF) {
+        return true;
+    }
+    return memcmp(a + i, b + i, len - i) != 0;
+}
+
+__attribute__((target("avx2")))
+bool payload_differs_avx2(const unsigned char *a, const unsigned char *b, int len) {
+    __m256i diff0 = _mm256_setzero_si256(), diff1 = _mm256_setzero_si256();
+    int i = 0;
+
+    // Two independent accumulators, 64 bytes per step
+    for (; i + 64 <= len; i += 64) {
+        diff0 = _mm256_or_si256(diff0, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                                        _mm256_loadu_si256((const __m256i *)(b + i))));
+        diff1 = _mm256_or_si256(diff1, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i + 32)),
+                                                        _mm256_loadu_si256((const __m256i *)(b + i + 32))));
+    }
+    for (; i + 32 <= len; i += 32) {
+        diff0 = _mm256_or_si256(diff0, _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                                        _mm256_loadu_si256((const __m256i *)(b + i))));
+    }
+    __m256i diff = _mm256_or_si256(diff0, diff1);
+    if (!_mm256_testz_si256(diff, diff)) {
+        return true;
+    }
+    return payload_differs_sse2(a + i, b + i, len - i);
+}
+#endif
+
+bool payload_differs_dispatch(const unsigned char *a, const unsigned char *b, int len);
+bool (*payload_differs)(const unsigned char *, const unsigned char *, int) = payload_differs_dispatch;
+
+bool payload_differs_dispatch(const unsigned char *a, const unsigned char *b, int len) {
+    payload_differs = payload_differs_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        payload_differs = payload_differs_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        payload_differs = payload_differs_sse2;
+    }
+#endif
+    return payload_differs(a, b, len);
+}
+
+// CRC32C
+// -------------------------------------------------------------------
+// CRC32C (Castagnoli, reflected polynomial 0x82F63B78) as used by the -C
+// digest mode. SSE4.2 has an instruction for it; the table version is the
+// fallback and the reference.
+uint32_t crc32c_sw(const void *buf, int len, uint32_t crc) {
+    static uint32_t table[256];
+    static bool table_ready = false;
+    if (!table_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = c & 1 ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+            }
+            table[i] = c;
+        }
+        table_ready = true;
+    }
+
+    const unsigned char *p = buf;
+    crc = ~crc;
+    while (len-- > 0) {
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hw(const void *buf, int len, uint32_t crc) {
+    const unsigned char *p = buf;
+    uint64_t c = ~crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        c = _mm_crc32_u64(c, word);
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        c = _mm_crc32_u8((uint32_t)c, *p++);
+    }
+    return ~(uint32_t)c;
+}
+#endif
+
+uint32_t crc32c_dispatch(const void *buf, int len, uint32_t crc);
+uint32_t (*crc32c)(const void *, int, uint32_t) = crc32c_dispatch;
+
+uint32_t crc32c_dispatch(const void *buf, int len, uint32_t crc) {
+    crc32c_sw("", 0, 0); // Build the table before any thread races to use it
+    crc32c = crc32c_sw;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32c = crc32c_hw;
+    }
+#endif
+    return crc32c(buf, len, crc);
+}
 
 // Functions used in creating the ICMP packet
 // -------------------------------------------------------------------
-// Calculate ICMP checksum
-unsigned short calculate_checksum(unsigned short *buf, int size) {
-    unsigned long sum = 0;
+// One's-complement sum of `size` bytes added to `sum`, without the final fold.
+// The scalar, SSE2 and AVX2 versions produce sums that fold to the same value.
+uint64_t checksum_add_scalar(const void *buf, int size, uint64_t sum) {
+    const unsigned char *p = buf;
 
-    // Add up 16-bit words
-    while (size > 1) {
-        sum += *buf++;
+    // Add up 32-bit words; the fold puts the carries back where they belong
+    while (size >= 4) {
+        uint32_t word;
+        memcpy(&word, p, sizeof(word));
+        sum += word;
+        p += 4;
+        size -= 4;
+    }
+    if (size >= 2) {
+        uint16_t word;
+        memcpy(&word, p, sizeof(word));
+        sum += word;
+        p += 2;
         size -= 2;
     }
 
     // Add left-over byte, if any
     if (size == 1) {
-        sum += *(unsigned char *)buf;
+        sum += *p;
     }
+    return sum;
+}
 
-    // Fold 32-bit sum to 16 bits
-    sum = (sum >> 16) + (sum & 0xFFFF);
-    sum += (sum >> 16);
+#if defined(__x86_64__) || defined(__i386__)
+// Widen 16-bit words into 32-bit lanes, 16 bytes per step. Each step adds two
+// words to every lane (the low and high unpack), at most 2 * 0xFFFF, so lanes
+// are flushed every 32K steps: 32768 * 2 * 0xFFFF still fits in 32 bits.
+__attribute__((target("sse2")))
+uint64_t checksum_add_sse2(const void *buf, int size, uint64_t sum) {
+    const unsigned char *p = buf;
+    const __m128i zero = _mm_setzero_si128();
+
+    while (size >= 16) {
+        __m128i acc = _mm_setzero_si128();
+        int steps = size / 16 < 32768 ? size / 16 : 32768;
+        for (int i = 0; i < steps; i++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)p);
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+            p += 16;
+        }
+        size -= steps * 16;
+
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    return checksum_add_scalar(p, size, sum);
+}
+
+// Same as the SSE2 version, 32 bytes per step: again two words per lane per
+// step, so the same 32K-step flush keeps the lanes from overflowing
+__attribute__((target("avx2")))
+uint64_t checksum_add_avx2(const void *buf, int size, uint64_t sum) {
+    const unsigned char *p = buf;
+    const __m256i zero = _mm256_setzero_si256();
+
+    while (size >= 32) {
+        __m256i acc = _mm256_setzero_si256();
+        int steps = size / 32 < 32768 ? size / 32 : 32768;
+        for (int i = 0; i < steps; i++) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)p);
+            acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+            acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+            p += 32;
+        }
+        size -= steps * 32;
+
+        uint32_t lanes[8];
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        for (int i = 0; i < 8; i++) {
+            sum += lanes[i];
+        }
+    }
+    return checksum_add_sse2(p, size, sum);
+}
+#endif
+
+// Pick the widest implementation the CPU supports, once
+uint64_t checksum_add_dispatch(const void *buf, int size, uint64_t sum);
+uint64_t (*checksum_add)(const void *, int, uint64_t) = checksum_add_dispatch;
 
+uint64_t checksum_add_dispatch(const void *buf, int size, uint64_t sum) {
+    checksum_add = checksum_add_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        checksum_add = checksum_add_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        checksum_add = checksum_add_sse2;
+    }
+#endif
+    return checksum_add(buf, size, sum);
+}
+
+// Fold a wide one's-complement sum to 16 bits and complement it
+unsigned short checksum_fold(uint64_t sum) {
+    while (sum >> 16) {
+        sum = (sum >> 16) + (sum & 0xFFFF);
+    }
     return (unsigned short)(~sum);
 }
 
-// Verify checksum on received packet
-bool verify_checksum(unsigned short *buf, int size) {
-    // Save original checksum
-    unsigned short original_checksum = ((struct icmphdr *)buf)->checksum;
-    
-    // Zero out checksum field for calculation
-    ((struct icmphdr *)buf)->checksum = 0;
-    
-    // Calculate new checksum
-    unsigned short calculated = calculate_checksum(buf, size);
-    
-    // Restore original checksum
-    ((struct icmphdr *)buf)->checksum = original_checksum;
-    
-    // Compare
-    return original_checksum == calculated;
+// Calculate ICMP checksum
+unsigned short calculate_checksum(unsigned short *buf, int size) {
+    return checksum_fold(checksum_add(buf, size, 0));
 }
 
-// Prepare the ICMP packet with data for integrity verification
-void prepare_icmp_packet(struct icmphdr *icmp_header, int seq_num, int packet_size) {
-    // Zero out the packet
-    memset(icmp_header, 0, packet_size);
+// Update a checksum for `count` 16-bit words changing from old_words to
+// new_words without re-summing the packet (RFC 1624, eqn. 3: HC' = ~(~HC + ~m + m'))
+unsigned short checksum_adjust(unsigned short checksum, const unsigned short *old_words,
+                               const unsigned short *new_words, int count) {
+    uint64_t sum = (unsigned short)~checksum;
+    for (int i = 0; i < count; i++) {
+        sum += (unsigned short)~old_words[i] + new_words[i];
+    }
+    return checksum_fold(sum);
+}
+
+// Verify checksum on received packet. Summed with its checksum field, an
+// intact packet comes to 0xFFFF (negative zero), so the buffer is left as is.
+bool verify_checksum(const unsigned short *buf, int size) {
+    return checksum_fold(checksum_add(buf, size, 0)) == 0;
+}
+
+// Return the payload template for packet_size, building it on first use. The
+// pattern starts at an even offset (header + timestamp), so its sum can be
+// added to the header's as is. Built from main() before any threads start.
+const payload_template_t *get_payload_template(int packet_size) {
+    payload_template_t *tpl = &payload_template;
+    if (tpl->packet_size == packet_size && tpl->mode == integrity_mode) {
+        return tpl;
+    }
+
+    int pattern_len = packet_size - (int)sizeof(struct icmphdr) - (int)sizeof(struct timeval);
+    if (pattern_len < 0) {
+        pattern_len = 0;
+    }
+    unsigned char *pattern = realloc(tpl->pattern, pattern_len + 1);
+    if (!pattern) {
+        perror("Failed to allocate payload template");
+        exit(EXIT_FAILURE);
+    }
+    // In -C mode the pattern is led by its own CRC32C
+    int digest_len = integrity_mode == INTEGRITY_CRC32C && pattern_len >= (int)sizeof(uint32_t)
+                     ? sizeof(uint32_t) : 0;
+    for (int i = 0; i < pattern_len - digest_len; i++) {
+        pattern[digest_len + i] = i & 0xFF;
+    }
+    if (digest_len > 0) {
+        uint32_t digest = crc32c(pattern + digest_len, pattern_len - digest_len, 0);
+        memcpy(pattern, &digest, sizeof(digest));
+    }
+
+    tpl->pattern = pattern;
+    tpl->mode = integrity_mode;
+    tpl->pattern_len = pattern_len;
+    tpl->pattern_sum = checksum_add(pattern, pattern_len, 0);
+    tpl->packet_size = packet_size;
+    return tpl;
+}
+
+// Prepare the ICMP packet with data for integrity verification: header,
+// timestamp, then the size's pattern copied from its template. Only the
+// header and timestamp are summed for the checksum.
+void prepare_icmp_packet_id(struct icmphdr *icmp_header, unsigned short id, int seq_num, int packet_size) {
+    const payload_template_t *tpl = get_payload_template(packet_size);
 
     // Fill in ICMP header fields
     icmp_header->type = ICMP_ECHO;        // ICMP Echo Request
     icmp_header->code = 0;                // No code for Echo Request
-    icmp_header->un.echo.id = ident;      // Use our identifier
+    icmp_header->checksum = 0;
+    icmp_header->un.echo.id = id;         // Identifier of the sending flow
     icmp_header->un.echo.sequence = seq_num;  // Sequence number
 
-    // Fill data part with timestamp and incrementing pattern for integrity verification
+    // Add timestamp to data (truncated if the packet is too small to hold it)
     unsigned char *ptr = (unsigned char *)(icmp_header + 1);
-    
-    // Add timestamp to data
     struct timeval tv;
     gettimeofday(&tv, NULL);
-    memcpy(ptr, &tv, sizeof(tv));
-    ptr += sizeof(tv);
-    
-    // Fill remaining data with pattern
-    for (int i = 0; i < packet_size - sizeof(struct icmphdr) - sizeof(tv); i++) {
-        *ptr++ = i & 0xFF;
+    int stamp_len = packet_size - (int)sizeof(struct icmphdr);
+    if (stamp_len > (int)sizeof(tv)) {
+        stamp_len = sizeof(tv);
     }
+    memcpy(ptr, &tv, stamp_len);
 
-    // Calculate checksum after filling the data
-    icmp_header->checksum = 0;
-    icmp_header->checksum = calculate_checksum((unsigned short *)icmp_header, packet_size);
+    // Fill remaining data with the pattern
+    memcpy(ptr + stamp_len, tpl->pattern, tpl->pattern_len);
+
+    // Checksum the header and timestamp on top of the pattern's cached sum
+    uint64_t sum = checksum_add(icmp_header, sizeof(struct icmphdr) + stamp_len, tpl->pattern_sum);
+    icmp_header->checksum = checksum_fold(sum);
+}
+
+// Prepare an echo request carrying our own identifier
+void prepare_icmp_packet(struct icmphdr *icmp_header, int seq_num, int packet_size) {
+    prepare_icmp_packet_id(icmp_header, ident, seq_num, packet_size);
+}
+
+// Give a packet built by prepare_icmp_packet a new sequence number and
+// timestamp. Only the changed words are folded into the checksum, so the
+// payload is not summed again.
+void restamp_icmp_packet(struct icmphdr *icmp_header, int seq_num, int packet_size) {
+    // The sequence number and the timestamp words that follow the header
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    unsigned short old_words[1 + sizeof(tv) / 2], new_words[1 + sizeof(tv) / 2];
+    int words = (packet_size - (int)sizeof(struct icmphdr)) / 2;
+    if (words > (int)(sizeof(tv) / 2)) {
+        words = sizeof(tv) / 2;
+    }
+
+    unsigned short *stamp = (unsigned short *)(icmp_header + 1);
+    old_words[0] = icmp_header->un.echo.sequence;
+    new_words[0] = (unsigned short)seq_num;
+    memcpy(&old_words[1], stamp, words * 2);
+    memcpy(&new_words[1], &tv, words * 2);
+
+    icmp_header->checksum = checksum_adjust(icmp_header->checksum, old_words, new_words, 1 + words);
+    icmp_header->un.echo.sequence = seq_num;
+    memcpy(stamp, &tv, words * 2);
 }
 
-// Verify data integrity of received packet
+// Verify data integrity of received packet: either the embedded CRC32C
+// matches the rest of the payload, or the payload matches the template
 bool verify_packet_integrity(struct icmphdr *icmp_header, int data_size) {
-    unsigned char *ptr = (unsigned char *)(icmp_header + 1);
-    
-    // Skip timestamp
-    ptr += sizeof(struct timeval);
-    
-    // Verify pattern in the data portion
-    for (int i = 0; i < data_size - sizeof(struct timeval); i++) {
-        if (*ptr != (i & 0xFF)) {
+    const unsigned char *ptr = (const unsigned char *)(icmp_header + 1) + sizeof(struct timeval);
+    int len = data_size - (int)sizeof(struct timeval);
+    if (len <= 0) {
+        return true; // Nothing after the timestamp
+    }
+
+    if (integrity_mode == INTEGRITY_CRC32C) {
+        uint32_t digest;
+        if (len < (int)sizeof(digest)) {
             return false;
         }
-        ptr++;
+        memcpy(&digest, ptr, sizeof(digest));
+        return crc32c(ptr + sizeof(digest), len - sizeof(digest), 0) == digest;
     }
-    
-    return true;
+
+    // Replies are as long as the probes, so the template covers them
+    const payload_template_t *tpl = &payload_template;
+    return len <= tpl->pattern_len && !payload_differs(ptr, tpl->pattern, len);
 }
 
 // Clean up the socket between packets (NEW FUNCTION)
@@ -178,25 +687,46 @@ void flush_socket(int sock) {
     }
 }
 
-// Log message to file and stdout
-void log_message(const char *format, ...) {
-    va_list args, args_copy;
-    va_start(args, format);
-    
-    // Print to stdout
-    va_copy(args_copy, args);
-    vprintf(format, args_copy);
-    va_end(args_copy);
-    
-    // Write to log file if available
-    if (logfile) {
-        va_copy(args_copy, args);
-        vfprintf(logfile, format, args_copy);
-        fflush(logfile); // Ensure data is written immediately
-        va_end(args_copy);
+// Socket options shared by the raw and datagram probe sockets
+bool configure_probe_socket(int sock, int ttl, int timeout) {
+    // Set socket receive buffer size (NEW CODE)
+    int rcvbufsize = 1024 * 1024; // 1MB buffer
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbufsize, sizeof(rcvbufsize)) < 0) {
+        perror("setsockopt SO_RCVBUF failed");
+        // Non-fatal, continue execution
     }
-    
-    va_end(args);
+
+    // Set TTL value
+    if (setsockopt(sock, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) < 0) {
+        perror("setsockopt IP_TTL failed");
+        return false;
+    }
+
+    // Set timeout for receiving
+    struct timeval tv;
+    tv.tv_sec = timeout;
+    tv.tv_usec = 0;
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+        perror("setsockopt SO_RCVTIMEO failed");
+        return false;
+    }
+    return true;
+}
+
+// Create the raw ICMP socket probes go out on; -1 on failure
+int open_raw_socket(int ttl, int timeout) {
+    int sock = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+    if (sock < 0) {
+        perror("socket creation failed");
+        fprintf(stderr, "Note: This program requires root privileges to create raw sockets "
+                "(or -d for an ICMP datagram socket).\n");
+        return -1;
+    }
+    if (!configure_probe_socket(sock, ttl, timeout)) {
+        close(sock);
+        return -1;
+    }
+    return sock;
 }
 
 // Get current timestamp as milliseconds
@@ -206,121 +736,4930 @@ long long current_timestamp_ms() {
     return (long long)(tv.tv_sec) * 1000 + (tv.tv_usec / 1000);
 }
 
-// Add entry to packet history
-void add_packet_to_history(int seq_num) {
-    if (total_packets < MAX_HISTORY) {
-        packet_history[total_packets].seq_num = seq_num;
-        gettimeofday(&packet_history[total_packets].sent_time, NULL);
-        packet_history[total_packets].retries = 0;
-        packet_history[total_packets].received = false;
-        packet_history[total_packets].corrupted = false;
-        total_packets++;
+// Get monotonic time as nanoseconds (immune to wall-clock steps)
+long long monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Get wall-clock time as nanoseconds, the clock kernel packet timestamps use
+long long realtime_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Get current timestamp as microseconds (monotonic, for deadlines)
+long long current_timestamp_us() {
+    return monotonic_ns() / 1000;
+}
+
+// Logging
+// -------------------------------------------------------------------
+// Log lines are fixed-size events. Until log_start() they are written
+// straight away; after it, the caller only copies the event into a
+// single-producer ring and a writer thread formats the events and writes
+// them in batches, flushing once LOG_FLUSH_BYTES are pending or
+// LOG_FLUSH_MS have passed. Replies travel as binary events and are
+// formatted by the writer. If the ring is full, per-probe lines are dropped
+// and counted; summary lines wait for room. Only the main thread logs, which
+// is what keeps the ring single-producer: flood workers queue their corrupt
+// replies for it, and SIGINT only sets stop_ping.
+typedef enum {
+    LOG_EV_TEXT,              // Preformatted text (a long line takes several events)
+    LOG_EV_REPLY              // Echo reply, formatted by the writer
+} log_event_type_t;
+
+typedef struct {
+    unsigned char type;
+    unsigned char level;      // LOG_SUMMARY, LOG_EVENTS or LOG_REPLIES
+    unsigned short len;       // Text bytes in a LOG_EV_TEXT event
+    union {
+        char text[LOG_EVENT_TEXT];
+        struct {
+            int icmp_len;
+            int seq_num;
+            int ttl;
+            struct in_addr addr;
+            double rtt;
+            bool corrupted;
+            bool checksum_valid;
+            bool data_valid;
+        } reply;
+    };
+} log_event_t;
+
+typedef struct {
+    log_event_t *events;      // LOG_RING_EVENTS slots
+    unsigned head __attribute__((aligned(64)));  // Next slot to fill (main thread)
+    unsigned tail __attribute__((aligned(64)));  // Next slot to write (writer)
+    unsigned flush_requested __attribute__((aligned(64)));
+    unsigned flushed;
+    unsigned long long dropped;  // Per-probe lines lost to a full ring
+    int stop;
+    bool running;
+    pthread_t thread;
+    char *out;                // Writer's pending stdout text
+    char *file_out;           // Writer's pending log file text
+} log_ring_t;
+
+log_ring_t log_ring;
+
+// Whether a line at this level goes anywhere at all
+bool log_wanted(int level) {
+    return logfile || (log_to_stdout && level <= stdout_verbosity);
+}
+
+// Render an event as text; returns its length
+int format_log_event(const log_event_t *ev, char *buf, int size) {
+    if (ev->type == LOG_EV_TEXT) {
+        memcpy(buf, ev->text, ev->len);
+        return ev->len;
     }
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &ev->reply.addr, ip, sizeof(ip));
+    int len = snprintf(buf, size, "%d bytes from %s: icmp_seq=%d ttl=%d time=%.3f ms %s\n",
+                       ev->reply.icmp_len, ip, ev->reply.seq_num, ev->reply.ttl, ev->reply.rtt,
+                       ev->reply.corrupted ? "[CORRUPTED]" : "");
+    if (ev->reply.corrupted && len < size) {
+        len += snprintf(buf + len, size - len, "  Corruption details: checksum=%s, data=%s\n",
+                        ev->reply.checksum_valid ? "valid" : "invalid",
+                        ev->reply.data_valid ? "valid" : "invalid");
+    }
+    return len < size ? len : size - 1;
 }
 
-// Update packet history when packet is received
-void update_packet_history(int seq_num, double rtt, bool corrupted) {
-    for (int i = 0; i < total_packets; i++) {
-        if (packet_history[i].seq_num == seq_num) {
-            packet_history[i].received = true;
-            packet_history[i].rtt = rtt;
-            packet_history[i].corrupted = corrupted;
-            
-            if (packet_history[i].retries > 0) {
-                rereceived_count++;
-            }
-            
-            return;
-        }
+// Write out what the writer has batched up for stdout and the log file
+void log_writer_flush(char *out, int *out_len, char *file_out, int *file_len) {
+    if (*out_len > 0) {
+        fwrite(out, 1, *out_len, stdout);
+        fflush(stdout);
+        *out_len = 0;
     }
+    if (*file_len > 0 && logfile) {
+        fwrite(file_out, 1, *file_len, logfile);
+        fflush(logfile);
+    }
+    *file_len = 0;
 }
 
-// Find packet in history by sequence number
-packet_history_t *find_packet(int seq_num) {
-    for (int i = 0; i < total_packets; i++) {
-        if (packet_history[i].seq_num == seq_num) {
-            return &packet_history[i];
+// Writer thread: drain the ring, batch the text, flush on size or age
+void *log_writer_main(void *arg) {
+    log_ring_t *ring = arg;
+    char *out = ring->out;
+    char *file_out = ring->file_out;
+    int out_len = 0, file_len = 0;
+    unsigned long long dropped_reported = 0;
+    long long oldest_ns = 0;  // When the oldest unflushed line was batched
+
+    for (;;) {
+        unsigned requested = __atomic_load_n(&ring->flush_requested, __ATOMIC_ACQUIRE);
+        int stop = __atomic_load_n(&ring->stop, __ATOMIC_ACQUIRE);
+        unsigned head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        for (unsigned tail = ring->tail; tail != head; tail++) {
+            const log_event_t *ev = &ring->events[tail & (LOG_RING_EVENTS - 1)];
+            char line[LOG_LINE_MAX];
+            int len = format_log_event(ev, line, sizeof(line));
+            if (log_to_stdout && ev->level <= stdout_verbosity) {
+                memcpy(out + out_len, line, len);
+                out_len += len;
+            }
+            if (logfile) {
+                memcpy(file_out + file_len, line, len);
+                file_len += len;
+            }
+            __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+            if (out_len >= LOG_FLUSH_BYTES || file_len >= LOG_FLUSH_BYTES) {
+                log_writer_flush(out, &out_len, file_out, &file_len);
+            }
+        }
+
+        unsigned long long dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        if (dropped != dropped_reported) {
+            char line[LOG_LINE_MAX];
+            int len = snprintf(line, sizeof(line), "Logger: %llu lines dropped (ring full)\n",
+                               dropped - dropped_reported);
+            if (log_to_stdout) {
+                memcpy(out + out_len, line, len);
+                out_len += len;
+            }
+            if (logfile) {
+                memcpy(file_out + file_len, line, len);
+                file_len += len;
+            }
+            dropped_reported = dropped;
+        }
+
+        long long now_ns = monotonic_ns();
+        if (out_len == 0 && file_len == 0) {
+            oldest_ns = now_ns;
+        }
+        if (requested != __atomic_load_n(&ring->flushed, __ATOMIC_RELAXED) || stop ||
+            now_ns - oldest_ns >= LOG_FLUSH_MS * 1000000LL) {
+            log_writer_flush(out, &out_len, file_out, &file_len);
+            oldest_ns = now_ns;
+            __atomic_store_n(&ring->flushed, requested, __ATOMIC_RELEASE);
+        }
+        if (stop) {
+            break;
+        }
+        if (head == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+            usleep(1000);
         }
     }
     return NULL;
 }
 
-// Print detailed statistics
-void print_statistics() {
-    log_message("\n--- Ping Statistics ---\n");
-    log_message("Total packets: %d original, %d including retries\n", original_send_count, send_count);
-    log_message("Received: %d (%.1f%% packet loss)\n", 
-                recv_count, 
-                original_send_count ? ((original_send_count - recv_count) * 100.0) / original_send_count : 0);
-    log_message("Retransmitted: %d\n", resend_count);
-    log_message("Received after retry: %d\n", rereceived_count);
-    log_message("Corrupted packets: %d\n", corrupt_count);
-    
-    // Calculate RTT statistics
-    double min_rtt = -1, max_rtt = -1, avg_rtt = 0;
-    int rtt_count = 0;
-    
-    for (int i = 0; i < total_packets; i++) {
-        if (packet_history[i].received && !packet_history[i].corrupted) {
-            double rtt = packet_history[i].rtt;
-            
-            if (min_rtt == -1 || rtt < min_rtt) min_rtt = rtt;
-            if (max_rtt == -1 || rtt > max_rtt) max_rtt = rtt;
-            avg_rtt += rtt;
-            rtt_count++;
-        }
+// Start a helper thread with SIGINT blocked, so Ctrl+C always reaches the
+// main thread and cuts its waits short
+int start_thread(pthread_t *thread, void *(*start)(void *), void *arg) {
+    sigset_t block, saved;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &block, &saved);
+    int err = pthread_create(thread, NULL, start, arg);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    return err;
+}
+
+void log_free_buffers(log_ring_t *ring) {
+    free(ring->events);
+    free(ring->out);
+    free(ring->file_out);
+    ring->events = NULL;
+    ring->out = ring->file_out = NULL;
+}
+
+// Move logging onto the writer thread; stays synchronous if that fails
+void log_start(void) {
+    log_ring_t *ring = &log_ring;
+    if (ring->running) {
+        return;
     }
-    
-    if (rtt_count > 0) {
-        avg_rtt /= rtt_count;
-        log_message("RTT min/avg/max = %.3f/%.3f/%.3f ms\n", min_rtt, avg_rtt, max_rtt);
+    memset(ring, 0, sizeof(*ring));
+    ring->events = malloc(LOG_RING_EVENTS * sizeof(log_event_t));
+    ring->out = malloc(LOG_FLUSH_BYTES + LOG_LINE_MAX);
+    ring->file_out = malloc(LOG_FLUSH_BYTES + LOG_LINE_MAX);
+    if (!ring->events || !ring->out || !ring->file_out) {
+        log_free_buffers(ring);
+        return;
+    }
+    fflush(stdout);
+    if (start_thread(&ring->thread, log_writer_main, ring) != 0) {
+        log_free_buffers(ring);
+        return;
     }
+    ring->running = true;
 }
 
-// Get delay between packets based on experiment mode
-int get_ping_interval() {
-    switch (mode) {
-        case MODE_AGGRESSIVE:
-            return 200; // 200ms between pings
-        
-        case MODE_INTERMITTENT:
-            // Random interval between 500ms and 3000ms
-            return 500 + (rand() % 2500);
-            
-        case MODE_STANDARD:
-        default:
-            return 1000; // 1 second between pings
+// Wait until everything logged so far has been written
+void log_flush(void) {
+    log_ring_t *ring = &log_ring;
+    if (!ring->running) {
+        return;
+    }
+    unsigned requested = ring->flush_requested + 1;
+    __atomic_store_n(&ring->flush_requested, requested, __ATOMIC_RELEASE);
+    while ((int)(__atomic_load_n(&ring->flushed, __ATOMIC_ACQUIRE) - requested) < 0) {
+        usleep(100);
     }
 }
 
-// Handle signals (Ctrl+C)
-void signal_handler(int signo) {
-    if (signo == SIGINT) {
-        stop_ping = 1;
-        print_statistics();
+// Write everything out and stop the writer thread; logging is synchronous again
+void log_stop(void) {
+    log_ring_t *ring = &log_ring;
+    if (!ring->running) {
+        return;
+    }
+    __atomic_store_n(&ring->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(ring->thread, NULL);
+    ring->running = false;
+    log_free_buffers(ring);
+}
 
-        // Close resources
-        if (logfile) {
-            fclose(logfile);
+// Hand an event to the writer, or write it now if there is none
+void log_emit(const log_event_t *ev) {
+    log_ring_t *ring = &log_ring;
+    if (ring->running) {
+        unsigned head = ring->head;
+        while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_EVENTS) {
+            if (ev->level > LOG_SUMMARY) {
+                __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+                return;
+            }
+            sched_yield();
         }
-        close(sockfd);
-        exit(0);
+        ring->events[head & (LOG_RING_EVENTS - 1)] = *ev;
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+        return;
     }
-}
 
-// Print usage information
-void print_usage(char *prog_name) {
-    fprintf(stderr, "Usage: %s <hostname/IP> [options]\n", prog_name);
-    fprintf(stderr, "Options:\n");
-    fprintf(stderr, "  -s <size>      Packet size (default: %d)\n", PACKET_SIZE);
-    fprintf(stderr, "  -t <ttl>       Time to live (default: %d)\n", DEFAULT_TTL);
-    fprintf(stderr, "  -c <count>     Number of packets to send (default: infinite)\n");
-    fprintf(stderr, "  -i <interval>  Wait interval in ms (default: mode dependent)\n");
-    fprintf(stderr, "  -w <timeout>   Response timeout in seconds (default: %d)\n", MAX_WAIT_TIME);
-    fprintf(stderr, "  -r <retries>   Number of retries per packet (default: %d)\n", MAX_RETRY);
-    fprintf(stderr, "  -m <mode>      Experiment mode (1=standard, 2=aggressive, 3=intermittent)\n");
-    fprintf(stderr, "  -l <file>      Log file name\n");
-    fprintf(stderr, "  -h             Show this help message\n");
+    char line[LOG_LINE_MAX];
+    int len = format_log_event(ev, line, sizeof(line));
+    if (log_to_stdout && ev->level <= stdout_verbosity) {
+        fwrite(line, 1, len, stdout);
+    }
+    if (logfile) {
+        fwrite(line, 1, len, logfile);
+        fflush(logfile); // Ensure data is written immediately
+    }
+}
+
+// Log a line at the given verbosity level
+void log_vmessage(int level, const char *format, va_list args) {
+    if (!log_wanted(level)) {
+        return;
+    }
+
+    char text[LOG_LINE_MAX];
+    int len = vsnprintf(text, sizeof(text), format, args);
+    if (len >= (int)sizeof(text)) {
+        len = sizeof(text) - 1;
+    }
+
+    // Split lines longer than one event over several
+    log_event_t ev;
+    ev.type = LOG_EV_TEXT;
+    ev.level = level;
+    for (int off = 0; off < len; off += ev.len) {
+        ev.len = len - off < LOG_EVENT_TEXT ? len - off : LOG_EVENT_TEXT;
+        memcpy(ev.text, text + off, ev.len);
+        log_emit(&ev);
+    }
+}
+
+// Log message to file and stdout
+void log_message(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    log_vmessage(LOG_SUMMARY, format, args);
+    va_end(args);
+}
+
+// Log a per-probe line, shown on stdout only at verbosity `level` or above
+void log_verbose(int level, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    log_vmessage(level, format, args);
+    va_end(args);
+}
+
+// Print the per-reply line (and corruption details)
+void log_reply(int icmp_len, struct sockaddr_in *recv_addr, int seq_num, int ttl, double rtt,
+               bool is_corrupted, bool checksum_valid, bool data_valid) {
+    if (!log_wanted(LOG_REPLIES)) {
+        return;
+    }
+
+    log_event_t ev;
+    ev.type = LOG_EV_REPLY;
+    ev.level = LOG_REPLIES;
+    ev.reply.icmp_len = icmp_len;
+    ev.reply.seq_num = seq_num;
+    ev.reply.ttl = ttl;
+    ev.reply.addr = recv_addr->sin_addr;
+    ev.reply.rtt = rtt;
+    ev.reply.corrupted = is_corrupted;
+    ev.reply.checksum_valid = checksum_valid;
+    ev.reply.data_valid = data_valid;
+    log_emit(&ev);
+}
+
+// Binary results
+// -------------------------------------------------------------------
+// With -o, every probe's final outcome is appended to a binary file as a
+// fixed-size record, so analysis can mmap the file instead of parsing log
+// text. The file is a result_header_t describing the run, then one
+// probe_record_t per probe in sequence order, written when the probe's
+// history slot is reused (or at the end of the run). Closing the file adds an
+// index of every RESULT_INDEX_STRIDE-th record and a result_trailer_t. A file
+// cut short by a crash has no trailer; its records are still readable, since
+// their count follows from the file size. -D dumps a file as CSV.
+#define RESULT_MAGIC        "EPRB"
+#define RESULT_TRAILER_MAGIC "EPRBIDX"
+#define RESULT_VERSION      1
+#define RESULT_INDEX_STRIDE 4096   // Records per index entry
+#define RESULT_FLUSH_NS     1000000000LL  // Records reach the file at least once a second
+
+// Header flags
+#define RESULT_KERNEL_TIMESTAMPS 0x1
+#define RESULT_CRC32C            0x2
+#define RESULT_OPEN_LOOP         0x4
+
+// Record flags
+#define RECORD_REPLIED      0x1
+#define RECORD_CORRUPTED    0x2
+#define RECORD_UNREACHABLE  0x4
+#define RECORD_TTL_EXCEEDED 0x8
+
+typedef struct {
+    char magic[4];            // RESULT_MAGIC
+    uint16_t version;
+    uint16_t header_size;     // sizeof(result_header_t): records start here
+    uint16_t record_size;     // sizeof(probe_record_t)
+    uint16_t flags;           // RESULT_*
+    int32_t packet_size;
+    int32_t count;            // -1 = until interrupted
+    int32_t interval_ms;
+    int32_t timeout_s;
+    int32_t retries;
+    int32_t window;
+    int32_t batch;
+    int32_t ttl;
+    int32_t mode;             // 1-based, as given to -m
+    double pps;               // Paced rate, 0 if closed loop
+    int64_t start_realtime_ns;   // Wall clock when the file was opened
+    int64_t start_monotonic_ns;  // CLOCK_MONOTONIC at the same moment
+    char target[64];
+    char target_ip[16];
+    char reserved[104];       // Pads the header to 256 bytes
+} result_header_t;
+
+typedef struct {
+    int64_t send_ns;          // CLOCK_MONOTONIC time of the last transmission
+    int64_t recv_ns;          // send_ns plus the measured RTT; 0 if unanswered
+    uint32_t seq;
+    uint16_t size;            // ICMP bytes in the reply
+    uint8_t ttl;              // TTL of the reply
+    uint8_t flags;            // RECORD_*
+    uint16_t retries;
+    uint16_t reserved;
+    uint32_t reserved2;
+} probe_record_t;
+
+typedef struct {
+    uint32_t first_seq;       // Sequence number of record i * index_stride
+    uint32_t reserved;
+    int64_t send_ns;          // Its send time
+} result_index_t;
+
+typedef struct {
+    uint64_t record_count;
+    uint64_t index_offset;    // File offset of the first result_index_t
+    uint32_t index_count;
+    uint32_t index_stride;
+    char magic[8];            // RESULT_TRAILER_MAGIC
+} result_trailer_t;
+
+// Writer state for the run's results file
+typedef struct {
+    FILE *file;
+    uint64_t record_count;
+    result_index_t *index;
+    uint32_t index_count;
+    uint32_t index_capacity;
+    long long last_flush_ns;
+} result_writer_t;
+
+result_writer_t results;
+
+// Start a results file for a run against target
+bool results_open(const char *path, const experiment_t *exp, const char *target, const char *ip) {
+    result_writer_t *w = &results;
+    w->file = fopen(path, "wb");
+    if (!w->file) {
+        perror("Failed to open results file");
+        return false;
+    }
+    setvbuf(w->file, NULL, _IOFBF, 1 << 20);
+
+    result_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, RESULT_MAGIC, sizeof(hdr.magic));
+    hdr.version = RESULT_VERSION;
+    hdr.header_size = sizeof(result_header_t);
+    hdr.record_size = sizeof(probe_record_t);
+    hdr.flags = (kernel_timestamps ? RESULT_KERNEL_TIMESTAMPS : 0) |
+                (integrity_mode == INTEGRITY_CRC32C ? RESULT_CRC32C : 0) |
+                (exp->pps > 0 ? RESULT_OPEN_LOOP : 0);
+    hdr.packet_size = exp->packet_size;
+    hdr.count = exp->count;
+    hdr.interval_ms = exp->interval;
+    hdr.timeout_s = exp->timeout;
+    hdr.retries = exp->retries;
+    hdr.window = exp->window;
+    hdr.batch = exp->batch;
+    hdr.ttl = exp->ttl;
+    hdr.mode = mode + 1;
+    hdr.pps = exp->pps;
+    hdr.start_realtime_ns = realtime_ns();
+    hdr.start_monotonic_ns = monotonic_ns();
+    snprintf(hdr.target, sizeof(hdr.target), "%s", target);
+    snprintf(hdr.target_ip, sizeof(hdr.target_ip), "%s", ip);
+    fwrite(&hdr, sizeof(hdr), 1, w->file);
+    fflush(w->file);
+
+    w->record_count = 0;
+    w->index_count = 0;
+    w->last_flush_ns = hdr.start_monotonic_ns;
+    return true;
+}
+
+// Append the final state of one probe
+void results_write(const packet_history_t *pkt) {
+    result_writer_t *w = &results;
+    probe_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.send_ns = pkt->sent_ns;
+    rec.seq = pkt->seq_num;
+    rec.retries = pkt->retries;
+    if (pkt->received) {
+        rec.recv_ns = pkt->sent_ns + (int64_t)(pkt->rtt * 1000000.0);
+        rec.size = pkt->reply_len;
+        rec.ttl = pkt->ttl;
+        rec.flags |= RECORD_REPLIED | (pkt->corrupted ? RECORD_CORRUPTED : 0);
+    }
+    if (pkt->icmp_error == ICMP_DEST_UNREACH) {
+        rec.flags |= RECORD_UNREACHABLE;
+    } else if (pkt->icmp_error == ICMP_TIME_EXCEEDED) {
+        rec.flags |= RECORD_TTL_EXCEEDED;
+    }
+
+    if (w->record_count % RESULT_INDEX_STRIDE == 0) {
+        if (w->index_count == w->index_capacity) {
+            uint32_t capacity = w->index_capacity ? w->index_capacity * 2 : 64;
+            result_index_t *index = realloc(w->index, capacity * sizeof(result_index_t));
+            if (index) {
+                w->index = index;
+                w->index_capacity = capacity;
+            }
+        }
+        if (w->index_count < w->index_capacity) {
+            w->index[w->index_count].first_seq = rec.seq;
+            w->index[w->index_count].reserved = 0;
+            w->index[w->index_count++].send_ns = rec.send_ns;
+        }
+    }
+    fwrite(&rec, sizeof(rec), 1, w->file);
+    w->record_count++;
+
+    // Keep the file current for readers while the run goes on
+    long long now_ns = monotonic_ns();
+    if (now_ns - w->last_flush_ns >= RESULT_FLUSH_NS) {
+        fflush(w->file);
+        w->last_flush_ns = now_ns;
+    }
+}
+
+// Write out the probes still in the history, then the index and trailer
+void results_close(void) {
+    result_writer_t *w = &results;
+    if (!w->file) {
+        return;
+    }
+
+    for (int seq = highest_seq - HISTORY_SIZE + 1; seq <= highest_seq; seq++) {
+        const packet_history_t *pkt = &packet_history[seq & (HISTORY_SIZE - 1)];
+        if (seq >= 0 && pkt->in_use && pkt->seq_num == seq) {
+            results_write(pkt);
+        }
+    }
+
+    // A partial index is still usable, so a failed realloc above only thins it
+    result_trailer_t trailer;
+    memset(&trailer, 0, sizeof(trailer));
+    trailer.record_count = w->record_count;
+    trailer.index_offset = sizeof(result_header_t) + w->record_count * sizeof(probe_record_t);
+    trailer.index_count = w->index_count;
+    trailer.index_stride = RESULT_INDEX_STRIDE;
+    memcpy(trailer.magic, RESULT_TRAILER_MAGIC, sizeof(trailer.magic));
+    fwrite(w->index, sizeof(result_index_t), w->index_count, w->file);
+    fwrite(&trailer, sizeof(trailer), 1, w->file);
+    fclose(w->file);
+
+    free(w->index);
+    memset(w, 0, sizeof(*w));
+}
+
+// A results file mapped for reading
+typedef struct {
+    void *map;
+    size_t size;
+    const result_header_t *header;
+    const probe_record_t *records;
+    uint64_t record_count;
+    const result_index_t *index;  // NULL if the run didn't finish
+    uint32_t index_count;
+    uint32_t index_stride;
+} result_file_t;
+
+// Map a results file and locate its records and index
+bool result_file_open(const char *path, result_file_t *rf) {
+    memset(rf, 0, sizeof(*rf));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(result_header_t)) {
+        fprintf(stderr, "%s: not a results file\n", path);
+        close(fd);
+        return false;
+    }
+    rf->size = st.st_size;
+    rf->map = mmap(NULL, rf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (rf->map == MAP_FAILED) {
+        perror("mmap failed");
+        return false;
+    }
+
+    rf->header = rf->map;
+    if (memcmp(rf->header->magic, RESULT_MAGIC, 4) != 0 || rf->header->version != RESULT_VERSION ||
+        rf->header->record_size != sizeof(probe_record_t) || rf->header->header_size > rf->size) {
+        fprintf(stderr, "%s: not a version %d results file\n", path, RESULT_VERSION);
+        munmap(rf->map, rf->size);
+        return false;
+    }
+    rf->records = (const probe_record_t *)((const char *)rf->map + rf->header->header_size);
+    rf->record_count = (rf->size - rf->header->header_size) / sizeof(probe_record_t);
+
+    // Trust the trailer only if it matches the file it ends
+    const result_trailer_t *trailer =
+        (const result_trailer_t *)((const char *)rf->map + rf->size - sizeof(result_trailer_t));
+    if (rf->size >= rf->header->header_size + sizeof(result_trailer_t) &&
+        memcmp(trailer->magic, RESULT_TRAILER_MAGIC, sizeof(trailer->magic)) == 0 &&
+        trailer->index_offset == rf->header->header_size + trailer->record_count * sizeof(probe_record_t) &&
+        trailer->index_offset + trailer->index_count * sizeof(result_index_t) + sizeof(result_trailer_t) == rf->size) {
+        rf->record_count = trailer->record_count;
+        rf->index = (const result_index_t *)((const char *)rf->map + trailer->index_offset);
+        rf->index_count = trailer->index_count;
+        rf->index_stride = trailer->index_stride;
+    }
+    return true;
+}
+
+void result_file_close(result_file_t *rf) {
+    munmap(rf->map, rf->size);
+}
+
+// Position of the first record with seq >= `seq`: a binary search of the
+// index, then a scan of at most one stride
+uint64_t result_file_seek(const result_file_t *rf, uint32_t seq) {
+    uint64_t pos = 0;
+    if (rf->index && rf->index_count > 0) {
+        uint32_t lo = 0, hi = rf->index_count;
+        while (hi - lo > 1) {
+            uint32_t mid = (lo + hi) / 2;
+            if (rf->index[mid].first_seq <= seq) lo = mid; else hi = mid;
+        }
+        pos = (uint64_t)lo * rf->index_stride;
+    }
+    while (pos < rf->record_count && rf->records[pos].seq < seq) {
+        pos++;
+    }
+    return pos;
+}
+
+// -D: print a results file as CSV; "file:first-last" limits the sequence range
+int run_result_dump(const char *arg) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", arg);
+    uint32_t first = 0, last = UINT32_MAX;
+    char *range = strrchr(path, ':');
+    if (range && sscanf(range + 1, "%u-%u", &first, &last) >= 1) {
+        *range = '\0';
+        if (!strchr(range + 1, '-')) {
+            last = first;
+        }
+    }
+
+    result_file_t rf;
+    if (!result_file_open(path, &rf)) {
+        return EXIT_FAILURE;
+    }
+
+    const result_header_t *h = rf.header;
+    printf("# target=%s ip=%s size=%d count=%d interval_ms=%d timeout_s=%d retries=%d "
+           "window=%d batch=%d ttl=%d mode=%d pps=%.1f flags=0x%x start_realtime_ns=%lld%s\n",
+           h->target, h->target_ip, h->packet_size, h->count, h->interval_ms, h->timeout_s,
+           h->retries, h->window, h->batch, h->ttl, h->mode, h->pps, h->flags,
+           (long long)h->start_realtime_ns, rf.index ? "" : " (incomplete: no index)");
+    printf("seq,send_ns,recv_ns,rtt_ms,size,ttl,retries,status\n");
+
+    for (uint64_t i = result_file_seek(&rf, first); i < rf.record_count && rf.records[i].seq <= last; i++) {
+        const probe_record_t *rec = &rf.records[i];
+        const char *status = rec->flags & RECORD_CORRUPTED ? "corrupted" :
+                             rec->flags & RECORD_REPLIED ? "ok" :
+                             rec->flags & RECORD_UNREACHABLE ? "unreachable" :
+                             rec->flags & RECORD_TTL_EXCEEDED ? "ttl_exceeded" : "lost";
+        // Times relative to the start of the run
+        long long send_ns = rec->send_ns - h->start_monotonic_ns;
+        if (rec->flags & RECORD_REPLIED) {
+            printf("%u,%lld,%lld,%.6f,%u,%u,%u,%s\n", rec->seq, send_ns,
+                   (long long)(rec->recv_ns - h->start_monotonic_ns),
+                   (rec->recv_ns - rec->send_ns) / 1e6, rec->size, rec->ttl, rec->retries, status);
+        } else {
+            printf("%u,%lld,,,,,%u,%s\n", rec->seq, send_ns, rec->retries, status);
+        }
+    }
+
+    result_file_close(&rf);
+    return EXIT_SUCCESS;
+}
+
+// Stats publication
+// -------------------------------------------------------------------
+// Statistics published through a seqlock. The owning thread is the only
+// writer; readers retry until they copy a snapshot no write overlapped. Flood
+// workers each publish into their own shard; the engines running on the main
+// thread publish into metrics_shard for the -M exporter.
+typedef struct {
+    unsigned seq;             // Odd while the owner is updating
+    ping_stats_t stats;
+} stats_shard_t;
+
+void shard_write_begin(stats_shard_t *shard) {
+    __atomic_store_n(&shard->seq, shard->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void shard_write_end(stats_shard_t *shard) {
+    __atomic_store_n(&shard->seq, shard->seq + 1, __ATOMIC_RELEASE);
+}
+
+void shard_snapshot(const stats_shard_t *shard, ping_stats_t *out) {
+    while (1) {
+        unsigned before = __atomic_load_n(&shard->seq, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            continue;
+        }
+        memcpy(out, &shard->stats, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shard->seq, __ATOMIC_RELAXED) == before) {
+            return;
+        }
+    }
+}
+
+stats_shard_t metrics_shard;  // Latest run statistics, for the exporter thread
+bool metrics_enabled = false; // -M: publish into metrics_shard
+long long metrics_next_ns = 0;  // When the stats are next due to be published
+pthread_t metrics_thread;     // Exporter thread, once metrics_enabled
+
+// Publish a copy of `st` for the exporter
+void metrics_publish(const ping_stats_t *st) {
+    shard_write_begin(&metrics_shard);
+    memcpy(&metrics_shard.stats, st, sizeof(*st));
+    shard_write_end(&metrics_shard);
+}
+
+// True (once per METRICS_PUBLISH_NS) when it is time to publish again
+bool metrics_due(long long now_ns) {
+    if (!metrics_enabled || now_ns < metrics_next_ns) {
+        return false;
+    }
+    metrics_next_ns = now_ns + METRICS_PUBLISH_NS;
+    return true;
+}
+
+// Publish the run statistics if they are due; called from the send and reply
+// paths, so the engine loops need no timer of their own
+void metrics_tick(long long now_ns) {
+    if (metrics_due(now_ns)) {
+        metrics_publish(&stats);
+    }
+}
+
+// Packet history is a ring indexed by seq % HISTORY_SIZE, so insert and lookup
+// are O(1) and memory stays bounded however long the run. Each slot keeps the
+// full (unwrapped) sequence number, which doubles as a generation check: a
+// lookup only hits if the slot has not since been reused by a newer probe.
+
+// Add entry to packet history
+void add_packet_to_history(int seq_num) {
+    packet_history_t *pkt = &packet_history[seq_num & (HISTORY_SIZE - 1)];
+    if (results.file && pkt->in_use) {
+        results_write(pkt); // The probe leaving the ring is final
+    }
+    pkt->in_use = true;
+    pkt->seq_num = seq_num;
+    pkt->sent_ns = monotonic_ns();
+    pkt->tx_ns = 0;
+    pkt->retries = 0;
+    pkt->received = false;
+    pkt->rtt = 0;
+    pkt->corrupted = false;
+    pkt->reply_len = 0;
+    pkt->ttl = 0;
+    pkt->icmp_error = 0;
+
+    if (seq_num > highest_seq) {
+        highest_seq = seq_num;
+    }
+    metrics_tick(pkt->sent_ns);
+}
+
+// Find packet in history by sequence number
+packet_history_t *find_packet(int seq_num) {
+    if (seq_num < 0) {
+        return NULL;
+    }
+    packet_history_t *pkt = &packet_history[seq_num & (HISTORY_SIZE - 1)];
+    if (!pkt->in_use || pkt->seq_num != seq_num) {
+        return NULL; // Never sent, or slot reused by a later generation
+    }
+    return pkt;
+}
+
+// Map a 16-bit ICMP sequence back to the most recent full sequence number it can be
+int unwrap_sequence(unsigned short wire_seq) {
+    return highest_seq - (unsigned short)(highest_seq - wire_seq);
+}
+
+// Latency histogram
+// -------------------------------------------------------------------
+// Buckets follow the HDR layout: values below 2^HIST_SUB_BITS ns get a bucket
+// each, and every power of two above that is split into 2^HIST_SUB_BITS linear
+// sub-buckets. Memory is fixed and recording is a handful of instructions.
+
+// Map an RTT in nanoseconds to its bucket index
+int hist_bucket_index(uint64_t ns) {
+    if (ns >= (1ULL << HIST_MAX_EXP)) {
+        ns = (1ULL << HIST_MAX_EXP) - 1;
+    }
+    if (ns < (1ULL << HIST_SUB_BITS)) {
+        return (int)ns;
+    }
+    int msb = 63 - __builtin_clzll(ns);
+    int shift = msb - HIST_SUB_BITS;
+    return ((shift + 1) << HIST_SUB_BITS) + (int)((ns >> shift) - (1ULL << HIST_SUB_BITS));
+}
+
+// Midpoint of a bucket in nanoseconds
+double hist_bucket_value(int index) {
+    if (index < (1 << HIST_SUB_BITS)) {
+        return index;
+    }
+    int shift = (index >> HIST_SUB_BITS) - 1;
+    uint64_t sub = (1ULL << HIST_SUB_BITS) + (index & ((1 << HIST_SUB_BITS) - 1));
+    return (double)(sub << shift) + (double)(1ULL << shift) / 2.0;
+}
+
+// Record one RTT (ms) into the histogram, moments and jitter estimate
+void hist_record(latency_hist_t *hist, double rtt) {
+    uint64_t ns = rtt > 0 ? (uint64_t)(rtt * 1000000.0) : 0;
+    hist->buckets[hist_bucket_index(ns)]++;
+
+    if (hist->count == 0 || rtt < hist->min) hist->min = rtt;
+    if (hist->count == 0 || rtt > hist->max) hist->max = rtt;
+
+    // RFC 3550: J += (|D| - J) / 16, where D is the change in transit time
+    if (hist->count > 0) {
+        double d = fabs(rtt - hist->last_rtt);
+        hist->jitter += (d - hist->jitter) / 16.0;
+    }
+    hist->last_rtt = rtt;
+
+    hist->count++;
+    double delta = rtt - hist->mean;
+    hist->mean += delta / hist->count;
+    hist->m2 += delta * (rtt - hist->mean);
+}
+
+// RTT (ms) below which the given fraction of replies fall
+double hist_percentile(const latency_hist_t *hist, double fraction) {
+    if (hist->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)ceil(fraction * hist->count);
+    if (rank < 1) rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            // Bucket midpoints can overshoot the observed extremes
+            double value = hist_bucket_value(i) / 1000000.0;
+            if (value < hist->min) value = hist->min;
+            if (value > hist->max) value = hist->max;
+            return value;
+        }
+    }
+    return hist->max;
+}
+
+// Fold one histogram into another (Chan et al. for the moments). Jitter is a
+// per-stream estimate, so the merged value is the reply-weighted mean.
+void hist_merge(latency_hist_t *into, const latency_hist_t *from) {
+    if (from->count == 0) {
+        return;
+    }
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        into->buckets[i] += from->buckets[i];
+    }
+    if (into->count == 0 || from->min < into->min) into->min = from->min;
+    if (into->count == 0 || from->max > into->max) into->max = from->max;
+
+    double total = (double)into->count + from->count;
+    double delta = from->mean - into->mean;
+    into->m2 += from->m2 + delta * delta * into->count * from->count / total;
+    into->mean += delta * from->count / total;
+    into->jitter = (into->jitter * into->count + from->jitter * from->count) / total;
+    into->last_rtt = from->last_rtt;
+    into->count += from->count;
+}
+
+// Sample standard deviation of the recorded RTTs (ms)
+double hist_stddev(const latency_hist_t *hist) {
+    return hist->count > 1 ? sqrt(hist->m2 / (hist->count - 1)) : 0;
+}
+
+// Add one set of counters and RTTs into another
+void stats_merge(ping_stats_t *into, const ping_stats_t *from) {
+    into->send_count += from->send_count;
+    into->original_send_count += from->original_send_count;
+    into->recv_count += from->recv_count;
+    into->resend_count += from->resend_count;
+    into->rereceived_count += from->rereceived_count;
+    into->corrupt_count += from->corrupt_count;
+    hist_merge(&into->rtt, &from->rtt);
+}
+
+// Update packet history when packet is received
+void update_packet_history(int seq_num, double rtt, bool corrupted, int icmp_len, int ttl) {
+    if (!corrupted) {
+        hist_record(&stats.rtt, rtt);
+    }
+
+    packet_history_t *pkt = find_packet(seq_num);
+    if (!pkt) {
+        return;
+    }
+
+    pkt->received = true;
+    pkt->rtt = rtt;
+    pkt->corrupted = corrupted;
+    pkt->reply_len = icmp_len;
+    pkt->ttl = ttl;
+
+    if (pkt->retries > 0) {
+        stats.rereceived_count++;
+    }
+    if (metrics_enabled) {
+        metrics_tick(monotonic_ns());
+    }
+}
+
+// Remember that an ICMP error came back for a probe
+void note_icmp_error(int seq_num, int type) {
+    packet_history_t *pkt = find_packet(seq_num);
+    if (pkt) {
+        pkt->icmp_error = type;
+    }
+}
+
+// Print detailed statistics for one set of counters
+void print_statistics_for(const char *title, const ping_stats_t *st) {
+    log_message("\n--- %s ---\n", title);
+    log_message("Total packets: %d original, %d including retries\n", st->original_send_count, st->send_count);
+    log_message("Received: %d (%.1f%% packet loss)\n", 
+                st->recv_count, 
+                st->original_send_count ? ((st->original_send_count - st->recv_count) * 100.0) / st->original_send_count : 0);
+    log_message("Retransmitted: %d\n", st->resend_count);
+    log_message("Received after retry: %d\n", st->rereceived_count);
+    log_message("Corrupted packets: %d\n", st->corrupt_count);
+    
+    // RTT statistics are accumulated as replies arrive, so they cover the whole run
+    if (st->rtt.count > 0) {
+        log_message("RTT min/avg/max = %.3f/%.3f/%.3f ms\n", st->rtt.min, st->rtt.mean, st->rtt.max);
+        log_message("RTT stddev = %.3f ms, jitter = %.3f ms\n", hist_stddev(&st->rtt), st->rtt.jitter);
+        log_message("RTT p50/p90/p99/p99.9 = %.3f/%.3f/%.3f/%.3f ms\n",
+                    hist_percentile(&st->rtt, 0.50), hist_percentile(&st->rtt, 0.90),
+                    hist_percentile(&st->rtt, 0.99), hist_percentile(&st->rtt, 0.999));
+    }
+}
+
+// Print detailed statistics
+void print_statistics() {
+    print_statistics_for("Ping Statistics", &stats);
+}
+
+// Get delay between packets based on experiment mode
+int get_ping_interval() {
+    switch (mode) {
+        case MODE_AGGRESSIVE:
+            return 200; // 200ms between pings
+        
+        case MODE_INTERMITTENT:
+            // Random interval between 500ms and 3000ms
+            return 500 + (rand() % 2500);
+            
+        case MODE_STANDARD:
+        default:
+            return 1000; // 1 second between pings
+    }
+}
+
+// Parse a -p rate into probes per second: a number with an optional k/M/G
+// multiplier, in packets per second unless it ends in "bps" (bits per second
+// of whole IP datagrams). Returns 0 if the rate can't be parsed.
+double parse_rate(const char *arg, int packet_size) {
+    char *end;
+    double value = strtod(arg, &end);
+    switch (*end) {
+        case 'k': case 'K': value *= 1e3; end++; break;
+        case 'M': value *= 1e6; end++; break;
+        case 'G': value *= 1e9; end++; break;
+    }
+
+    if (strcmp(end, "bps") == 0) {
+        value /= (packet_size + sizeof(struct iphdr)) * 8.0;
+    } else if (*end != '\0' && strcmp(end, "pps") != 0) {
+        return 0;
+    }
+    return value > 0 ? value : 0;
+}
+
+// Kernel timestamps
+// -------------------------------------------------------------------
+// With -T, RTT is the difference between the kernel's software TX timestamp
+// (read back from the socket error queue) and its RX timestamp (delivered as a
+// control message with the reply), so select() wakeup, scheduling and logging
+// delays drop out. Without them RTT is measured with CLOCK_MONOTONIC.
+
+// Ask the kernel to timestamp our packets; returns false if it can't
+bool enable_kernel_timestamps(int sock) {
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE |
+                SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0) {
+        kernel_tx_timestamps = true;
+        return true;
+    }
+
+    // Older kernels: RX timestamps only, TX side is sampled just before sendto()
+    int on = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0) {
+        return true;
+    }
+    return false;
+}
+
+// Send a prepared probe; returns the monotonic send time in ns
+long long send_probe(char *packet, int packet_size, int seq_num) {
+    packet_history_t *pkt = find_packet(seq_num);
+    if (kernel_timestamps && pkt) {
+        pkt->tx_ns = realtime_ns(); // Replaced by the kernel TX timestamp when it arrives
+    }
+    long long sent_ns = monotonic_ns();
+    if (pkt) {
+        pkt->sent_ns = sent_ns;
+    }
+
+    int bytes_sent = sendto(sockfd, packet, packet_size, 0,
+                            (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+    if (bytes_sent < 0) {
+        perror("sendto failed");
+    } else {
+        stats.send_count++;
+        if (kernel_tx_timestamps) {
+            tx_id_seq[tx_id_next & (HISTORY_SIZE - 1)] = seq_num;
+            tx_id_next++;
+        }
+    }
+
+    return sent_ns;
+}
+
+// The extended error an error queue message carries (NULL if none)
+struct sock_extended_err *queued_error(struct msghdr *msg) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) {
+            return (struct sock_extended_err *)CMSG_DATA(cmsg);
+        }
+    }
+    return NULL;
+}
+
+// Record the TX timestamp an error queue message carries into the packet
+// history; anything else, or a send no longer in the ID table, is ignored
+void note_tx_timestamp(struct msghdr *msg) {
+    long long ts_ns = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING) {
+            struct timespec *ts = (struct timespec *)CMSG_DATA(cmsg);
+            ts_ns = (long long)ts[0].tv_sec * 1000000000LL + ts[0].tv_nsec;
+        }
+    }
+
+    struct sock_extended_err *err = queued_error(msg);
+    if (!err || err->ee_origin != SO_EE_ORIGIN_TIMESTAMPING || ts_ns == 0 ||
+        tx_id_next - err->ee_data > HISTORY_SIZE) {
+        return;
+    }
+    packet_history_t *pkt = find_packet(tx_id_seq[err->ee_data & (HISTORY_SIZE - 1)]);
+    if (pkt) {
+        pkt->tx_ns = ts_ns;
+    }
+}
+
+// Read pending TX timestamps from the error queue into the packet history. A
+// datagram socket's error queue also holds ICMP errors, so receive_datagram()
+// reads it instead.
+void drain_tx_timestamps(int sock) {
+    if (!kernel_tx_timestamps || dgram_socket) {
+        return;
+    }
+
+    char control[512];
+    while (1) {
+        struct msghdr msg = {0};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+        note_tx_timestamp(&msg);
+    }
+}
+
+// Kernel RX timestamp carried in a received message's control data (0 if none)
+long long rx_timestamp_ns(struct msghdr *msg) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            (cmsg->cmsg_type == SO_TIMESTAMPING || cmsg->cmsg_type == SO_TIMESTAMPNS)) {
+            struct timespec *ts = (struct timespec *)CMSG_DATA(cmsg);
+            return (long long)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+        }
+    }
+    return 0;
+}
+
+// RTT in ms for a probe sent at sent_ns and answered at recv_ns (monotonic),
+// preferring kernel timestamps when both ends of the exchange have one
+double probe_rtt(int seq_num, long long sent_ns, long long recv_ns, long long kernel_rx_ns) {
+    if (kernel_timestamps && kernel_rx_ns > 0) {
+        packet_history_t *pkt = find_packet(seq_num);
+        if (pkt && pkt->tx_ns > 0) {
+            return (kernel_rx_ns - pkt->tx_ns) / 1000000.0;
+        }
+    }
+    return (recv_ns - sent_ns) / 1000000.0;
+}
+
+// ICMP datagram sockets
+// -------------------------------------------------------------------
+// With -d probes go out on socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP), which
+// needs no privileges, only membership of a group in net.ipv4.ping_group_range.
+// The kernel picks the echo identifier (the socket's port), fills in the
+// checksum and only queues replies carrying our identifier, so no socket
+// filter is needed. Replies arrive without their IP header and the TTL comes
+// as an IP_RECVTTL control message; ICMP errors are not delivered as packets
+// but queued on the error queue (IP_RECVERR). receive_datagram() rebuilds
+// both into what a raw socket would have delivered, so every engine parses
+// them the same way.
+
+// Open the datagram socket and adopt the identifier the kernel gives it
+int open_dgram_socket(int ttl, int timeout) {
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP);
+    if (sock < 0) {
+        perror("ICMP datagram socket creation failed");
+        fprintf(stderr, "Note: Our group must be within net.ipv4.ping_group_range.\n");
+        return -1;
+    }
+
+    struct sockaddr_in local = { .sin_family = AF_INET };
+    socklen_t local_len = sizeof(local);
+    if (bind(sock, (struct sockaddr *)&local, sizeof(local)) < 0 ||
+        getsockname(sock, (struct sockaddr *)&local, &local_len) < 0) {
+        perror("Binding the ICMP datagram socket failed");
+        close(sock);
+        return -1;
+    }
+    ident = local.sin_port; // Network byte order, as the echo header carries it
+
+    int on = 1;
+    if (setsockopt(sock, IPPROTO_IP, IP_RECVTTL, &on, sizeof(on)) < 0 ||
+        setsockopt(sock, IPPROTO_IP, IP_RECVERR, &on, sizeof(on)) < 0) {
+        perror("setsockopt IP_RECVTTL/IP_RECVERR failed");
+        close(sock);
+        return -1;
+    }
+    if (!configure_probe_socket(sock, ttl, timeout)) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Open the socket the options ask for: datagram with -d, raw otherwise
+int open_probe_socket(int ttl, int timeout) {
+    return dgram_socket ? open_dgram_socket(ttl, timeout) : open_raw_socket(ttl, timeout);
+}
+
+// Write the IPv4 header a raw socket would have delivered in front of an
+// ICMP message of icmp_len bytes
+void build_ip_header(struct iphdr *ip, int icmp_len, in_addr_t saddr, in_addr_t daddr, int ttl) {
+    memset(ip, 0, sizeof(*ip));
+    ip->version = 4;
+    ip->ihl = sizeof(*ip) / 4;
+    ip->tot_len = htons(sizeof(*ip) + icmp_len);
+    ip->ttl = ttl;
+    ip->protocol = IPPROTO_ICMP;
+    ip->saddr = saddr;
+    ip->daddr = daddr;
+}
+
+// Take the next ICMP error off a datagram socket's error queue and rebuild
+// the packet that carried it: an IP header from the reporting host, the ICMP
+// error, and the quoted IP header and echo request. TX timestamps queued
+// ahead of it are recorded on the way. Returns 0 once the queue is empty.
+int receive_queued_error(int sock, char *buf, int len, struct sockaddr_in *from) {
+    struct iphdr *outer_ip = (struct iphdr *)buf;
+    struct icmphdr *icmp_header = (struct icmphdr *)(outer_ip + 1);
+    struct iphdr *inner_ip = (struct iphdr *)(icmp_header + 1);
+    char *quoted = (char *)(inner_ip + 1);
+    char control[512];
+
+    while (1) {
+        struct sockaddr_in probe_dest;
+        struct iovec iov = { quoted, len - (quoted - buf) };
+        struct msghdr msg = {0};
+        msg.msg_name = &probe_dest;
+        msg.msg_namelen = sizeof(probe_dest);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        int quoted_len = recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if (quoted_len < 0) {
+            return 0;
+        }
+
+        struct sock_extended_err *err = queued_error(&msg);
+        if (!err) {
+            continue;
+        }
+        if (err->ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+            note_tx_timestamp(&msg);
+            continue;
+        }
+        if (err->ee_origin != SO_EE_ORIGIN_ICMP) {
+            continue;
+        }
+
+        // The reporting host, or the probe's destination if the kernel doesn't say
+        struct sockaddr_in *offender = (struct sockaddr_in *)SO_EE_OFFENDER(err);
+        *from = offender->sin_family == AF_INET ? *offender : probe_dest;
+
+        build_ip_header(inner_ip, quoted_len, 0, probe_dest.sin_addr.s_addr, 0);
+        memset(icmp_header, 0, sizeof(*icmp_header));
+        icmp_header->type = err->ee_type;
+        icmp_header->code = err->ee_code;
+        int icmp_len = quoted - (char *)icmp_header + quoted_len;
+        build_ip_header(outer_ip, icmp_len, from->sin_addr.s_addr, 0, 0);
+        return sizeof(struct iphdr) + icmp_len;
+    }
+}
+
+// Receive one datagram, capturing its kernel RX timestamp (0 if none). From a
+// datagram socket, queued ICMP errors come first, and replies get back the IP
+// header the kernel stripped.
+int receive_datagram(int sock, char *buf, int len, int flags,
+                     struct sockaddr_in *from, long long *kernel_rx_ns) {
+    char control[512];
+    int header_len = 0;
+    *kernel_rx_ns = 0;
+    if (dgram_socket) {
+        int error_len = receive_queued_error(sock, buf, len, from);
+        if (error_len > 0) {
+            return error_len;
+        }
+        header_len = sizeof(struct iphdr);
+    }
+
+    struct iovec iov = { buf + header_len, len - header_len };
+    struct msghdr msg = {0};
+    msg.msg_name = from;
+    msg.msg_namelen = sizeof(*from);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    int bytes_received = recvmsg(sock, &msg, flags);
+    if (bytes_received > 0 && kernel_timestamps) {
+        *kernel_rx_ns = rx_timestamp_ns(&msg);
+    }
+    if (bytes_received > 0 && dgram_socket) {
+        int ttl = 0;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_TTL) {
+                memcpy(&ttl, CMSG_DATA(cmsg), sizeof(ttl));
+            }
+        }
+        build_ip_header((struct iphdr *)buf, bytes_received, from->sin_addr.s_addr, 0, ttl);
+        bytes_received += header_len;
+    }
+    return bytes_received;
+}
+
+// Socket filter
+// -------------------------------------------------------------------
+// A raw ICMP socket sees every ICMP packet on the host. This classic BPF
+// program runs in the kernel and only lets through echo replies carrying our
+// identifier (from one of our targets, when there are few enough to list) and
+// dest-unreachable/time-exceeded errors that quote one of our echo requests.
+// Everything else is dropped before it is queued, so concurrent pings no
+// longer wake each other up. Offsets are relative to the IP header.
+bool attach_reply_filter(int sock, unsigned short id, const in_addr_t *sources, int source_count) {
+    if (source_count > MAX_FILTER_SOURCES) {
+        source_count = 0; // Too many to list, match on the identifier alone
+    }
+
+    // Fixed prologue and error path, then the echo reply path and verdicts
+    int accept = 18 + (source_count > 0 ? 1 + source_count : 0);
+    int drop = accept + 1;
+    struct sock_filter code[20 + MAX_FILTER_SOURCES];
+    int n = 0;
+
+#define EMIT(insn) do { code[n] = (struct sock_filter)insn; n++; } while (0)
+#define JUMP_TO(label) ((label) - n - 1)
+    EMIT(BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0));            // X = IP header length
+    EMIT(BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0));             // ICMP type
+    EMIT(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHOREPLY, JUMP_TO(16), 0));
+    EMIT(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_DEST_UNREACH, JUMP_TO(5), 0));
+    EMIT(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_TIME_EXCEEDED, 0, JUMP_TO(drop)));
+
+    // ICMP error: the quoted datagram must be one of our echo requests
+    EMIT(BPF_STMT(BPF_LD | BPF_B | BPF_IND, 8 + 9));         // Quoted IP protocol
+    EMIT(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_ICMP, 0, JUMP_TO(drop)));
+    EMIT(BPF_STMT(BPF_LD | BPF_B | BPF_IND, 8));             // Quoted IP version/IHL
+    EMIT(BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0x0F));
+    EMIT(BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 2));
+    EMIT(BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0));
+    EMIT(BPF_STMT(BPF_MISC | BPF_TAX, 0));                   // X = quoted ICMP - 8
+    EMIT(BPF_STMT(BPF_LD | BPF_B | BPF_IND, 8));             // Quoted ICMP type
+    EMIT(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHO, 0, JUMP_TO(drop)));
+    EMIT(BPF_STMT(BPF_LD | BPF_H | BPF_IND, 8 + 4));         // Quoted identifier
+    EMIT(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohs(id), JUMP_TO(accept), JUMP_TO(drop)));
+
+    // Echo reply: our identifier, from one of our targets
+    EMIT(BPF_STMT(BPF_LD | BPF_H | BPF_IND, 4));             // Identifier
+    EMIT(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohs(id), 0, JUMP_TO(drop)));
+    if (source_count > 0) {
+        EMIT(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 12));        // IP source address
+        for (int i = 0; i < source_count; i++) {
+            EMIT(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(sources[i]),
+                          JUMP_TO(accept), i == source_count - 1 ? JUMP_TO(drop) : 0));
+        }
+    }
+    EMIT(BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF));             // accept
+    EMIT(BPF_STMT(BPF_RET | BPF_K, 0));                      // drop
+#undef JUMP_TO
+#undef EMIT
+
+    struct sock_fprog program = { .len = n, .filter = code };
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) < 0) {
+        return false;
+    }
+
+    // Anything queued before the filter went in was not screened
+    flush_socket(sock);
+    return true;
+}
+
+// Stop a socket from queueing anything at all (its error queue still works)
+bool attach_drop_filter(int sock) {
+    struct sock_filter code[] = { BPF_STMT(BPF_RET | BPF_K, 0) };
+    struct sock_fprog program = { .len = 1, .filter = code };
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) < 0) {
+        return false;
+    }
+    flush_socket(sock);
+    return true;
+}
+
+// TPACKET_V3 receive ring
+// -------------------------------------------------------------------
+// An AF_PACKET socket whose receive queue is a ring of blocks mapped into our
+// address space (PACKET_MMAP). The kernel writes replies straight into the
+// blocks, each with its RX timestamp, and hands over whole blocks at a time;
+// we parse them in place and give the blocks back, with no copy and no
+// syscall per packet. SOCK_DGRAM strips the link-layer header, so frames start
+// at the IP header and the socket filter works unchanged.
+
+typedef struct {
+    int fd;
+    unsigned char *map;       // Mapped ring: block_nr blocks of block_size bytes
+    struct tpacket_req3 req;
+    unsigned int block;       // Next block to hand to user space
+    long long packets;        // Frames delivered to the caller
+    long long fragments;      // IP fragments skipped (they aren't reassembled)
+} rx_ring_t;
+
+// Delivery callback: same shape as the raw-socket receive path
+typedef void (*rx_deliver_fn)(char *recv_packet, int bytes_received, struct sockaddr_in *recv_addr,
+                              long long recv_ns, long long kernel_rx_ns);
+
+// Open the packet socket, filter it to our replies and map its ring
+bool rx_ring_setup(rx_ring_t *ring) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+    if (ring->fd < 0) {
+        perror("AF_PACKET socket failed");
+        return false;
+    }
+
+    // Filter before the ring exists, so nothing unfiltered lands in it
+    if (!attach_reply_filter(ring->fd, ident, &dest_addr.sin_addr.s_addr, 1)) {
+        perror("setsockopt SO_ATTACH_FILTER failed");
+        goto fail;
+    }
+#ifdef PACKET_IGNORE_OUTGOING
+    // On loopback every packet would otherwise show up once in each direction
+    int one = 1;
+    setsockopt(ring->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#endif
+
+    int version = TPACKET_V3;
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        perror("setsockopt PACKET_VERSION failed");
+        goto fail;
+    }
+
+    ring->req.tp_block_size = RX_RING_BLOCK_SIZE;
+    ring->req.tp_block_nr = RX_RING_BLOCKS;
+    ring->req.tp_frame_size = 2048;
+    ring->req.tp_frame_nr = RX_RING_BLOCK_SIZE / 2048 * RX_RING_BLOCKS;
+    ring->req.tp_retire_blk_tov = RX_RING_BLOCK_TIMEOUT;
+    ring->req.tp_feature_req_word = 0;
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, &ring->req, sizeof(ring->req)) < 0) {
+        perror("setsockopt PACKET_RX_RING failed");
+        goto fail;
+    }
+
+    ring->map = mmap(NULL, (size_t)RX_RING_BLOCK_SIZE * RX_RING_BLOCKS, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_LOCKED, ring->fd, 0);
+    if (ring->map == MAP_FAILED) {
+        // MAP_LOCKED needs RLIMIT_MEMLOCK headroom; try without it
+        ring->map = mmap(NULL, (size_t)RX_RING_BLOCK_SIZE * RX_RING_BLOCKS, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, ring->fd, 0);
+    }
+    if (ring->map == MAP_FAILED) {
+        ring->map = NULL;
+        perror("mmap of the packet ring failed");
+        goto fail;
+    }
+    return true;
+
+fail:
+    close(ring->fd);
+    ring->fd = -1;
+    return false;
+}
+
+// Hand every block the kernel has finished with to `deliver`, then give the
+// blocks back. Returns the number of frames delivered.
+int rx_ring_drain(rx_ring_t *ring, rx_deliver_fn deliver) {
+    int delivered = 0;
+
+    while (1) {
+        struct tpacket_block_desc *desc =
+            (struct tpacket_block_desc *)(ring->map + (size_t)ring->block * RX_RING_BLOCK_SIZE);
+        if (!(__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+            break;
+        }
+
+        long long recv_ns = monotonic_ns();
+        struct tpacket3_hdr *frame =
+            (struct tpacket3_hdr *)((unsigned char *)desc + desc->hdr.bh1.offset_to_first_pkt);
+        for (unsigned int i = 0; i < desc->hdr.bh1.num_pkts; i++) {
+            char *ip_packet = (char *)frame + frame->tp_net;
+            struct iphdr *ip_header = (struct iphdr *)ip_packet;
+
+            if (ntohs(ip_header->frag_off) & (IP_MF | IP_OFFMASK)) {
+                ring->fragments++;
+            } else {
+                struct sockaddr_in recv_addr = { .sin_family = AF_INET };
+                recv_addr.sin_addr.s_addr = ip_header->saddr;
+                long long kernel_rx_ns = (long long)frame->tp_sec * 1000000000LL + frame->tp_nsec;
+                deliver(ip_packet, frame->tp_snaplen, &recv_addr, recv_ns, kernel_rx_ns);
+                delivered++;
+            }
+            frame = (struct tpacket3_hdr *)((unsigned char *)frame + frame->tp_next_offset);
+        }
+
+        __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        ring->block = (ring->block + 1) % RX_RING_BLOCKS;
+    }
+
+    ring->packets += delivered;
+    return delivered;
+}
+
+// Report what the kernel dropped, then unmap and close
+void rx_ring_teardown(rx_ring_t *ring) {
+    if (ring->fd < 0) {
+        return;
+    }
+
+    struct tpacket_stats_v3 st = {0};
+    socklen_t len = sizeof(st);
+    if (getsockopt(ring->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0) {
+        log_message("Ring: %lld frames received, %u dropped by the kernel, %u ring-full events, "
+                    "%lld fragments skipped\n",
+                    ring->packets, st.tp_drops, st.tp_freeze_q_cnt, ring->fragments);
+    }
+    if (ring->map) {
+        munmap(ring->map, (size_t)RX_RING_BLOCK_SIZE * RX_RING_BLOCKS);
+    }
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+// Low-jitter mode
+// -------------------------------------------------------------------
+// With -J the measurement thread runs pinned to one CPU, optionally under
+// SCHED_FIFO, with its memory locked and pre-faulted and a 1 ns timer slack.
+// Stop-and-wait and pipelined mode then poll the socket without ever blocking
+// in select(), and sleep only to PACE_SPIN_NS before a send, spinning the
+// rest. A poll pass slower than STALL_NS means the prober itself was held up
+// (preempted, interrupted, faulting), so stalls are counted and, in
+// stop-and-wait mode, tied to the reply whose RTT they inflated. How late
+// each probe left against its schedule is recorded in every mode, so a normal
+// run and a -J run can be compared.
+
+// Touch the stack the engines will run on so it is faulted in (and locked) now
+__attribute__((noinline)) void prefault_stack(void) {
+    volatile char buf[PREFAULT_STACK];
+    memset((char *)buf, 0, sizeof(buf));
+}
+
+// Move the calling thread onto `cpu` (and SCHED_FIFO at `priority` if > 0),
+// lock memory and enable busy polling on sockfd. Returns false if the CPU
+// can't be used; the other steps only warn.
+bool enter_low_jitter(int cpu, int priority) {
+    cpu_set_t allowed, set;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || !CPU_ISSET(cpu, &allowed)) {
+        fprintf(stderr, "CPU %d is not available to this process.\n", cpu);
+        return false;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        perror("sched_setaffinity failed");
+        return false;
+    }
+
+    // The logger and exporter threads were started first and keep the rest
+    CPU_CLR(cpu, &allowed);
+    if (CPU_COUNT(&allowed) > 0) {
+        if (log_ring.running) {
+            pthread_setaffinity_np(log_ring.thread, sizeof(allowed), &allowed);
+        }
+        if (metrics_enabled) {
+            pthread_setaffinity_np(metrics_thread, sizeof(allowed), &allowed);
+        }
+    } else if (priority > 0) {
+        fprintf(stderr, "Warning: CPU %d is the only one available; under SCHED_FIFO the logger "
+                "only runs when the kernel throttles us, so reply lines may be dropped.\n", cpu);
+    }
+
+    prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+    bool realtime = false;
+    if (priority > 0) {
+        struct sched_param param = { .sched_priority = priority };
+        realtime = sched_setscheduler(0, SCHED_FIFO, &param) == 0;
+        if (!realtime) {
+            perror("sched_setscheduler SCHED_FIFO failed, staying SCHED_OTHER");
+        }
+    }
+    bool locked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+    if (!locked) {
+        perror("mlockall failed");
+    }
+    prefault_stack();
+    int busy_poll_us = BUSY_POLL_US;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us, sizeof(busy_poll_us)) < 0) {
+        perror("setsockopt SO_BUSY_POLL failed");
+    }
+
+    low_jitter = true;
+    if (realtime) {
+        log_message("Low-jitter mode: CPU %d, SCHED_FIFO priority %d, memory %s, busy polling\n",
+                    cpu, priority, locked ? "locked" : "not locked");
+    } else {
+        log_message("Low-jitter mode: CPU %d, SCHED_OTHER, memory %s, busy polling\n",
+                    cpu, locked ? "locked" : "not locked");
+    }
+    return true;
+}
+
+// Account for one busy-poll pass; returns the current time. A pass slower
+// than STALL_NS is a stall of the prober. *last_ns is 0 on the first pass.
+long long poll_pass(long long *last_ns) {
+    long long now_ns = monotonic_ns();
+    long long gap = now_ns - *last_ns;
+    if (*last_ns != 0 && gap > STALL_NS) {
+        sched_noise.stalls++;
+        if (gap > sched_noise.max_stall_ns) {
+            sched_noise.max_stall_ns = gap;
+        }
+        if (gap > probe_stall_ns) {
+            probe_stall_ns = gap;
+        }
+    }
+    *last_ns = now_ns;
+    return now_ns;
+}
+
+// Record how late a new probe left against its schedule
+void note_send_lateness(long long intended_ns, long long sent_ns) {
+    long long late = sent_ns - intended_ns;
+    hist_record(&sched_noise.send_late, late > 0 ? late / 1e6 : 0);
+}
+
+// Wait until sock is readable or `timeout` has passed, like select() on one
+// socket. In low-jitter mode it polls instead of blocking. Either way the
+// time not waited is left in *timeout, as Linux select() does, so callers
+// that go back to waiting after a packet that isn't theirs keep one deadline.
+int wait_readable(int sock, struct timeval *timeout) {
+    if (!low_jitter) {
+        fd_set read_set;
+        FD_ZERO(&read_set);
+        FD_SET(sock, &read_set);
+        return select(sock + 1, &read_set, NULL, NULL, timeout);
+    }
+
+    struct pollfd pfd = { .fd = sock, .events = POLLIN };
+    long long last_ns = 0;
+    long long deadline_ns = monotonic_ns() + timeout->tv_sec * 1000000000LL + timeout->tv_usec * 1000LL;
+    int ready = -1;
+    while (!stop_ping) {
+        if (poll(&pfd, 1, 0) > 0) {
+            ready = 1;
+            break;
+        }
+        if (poll_pass(&last_ns) >= deadline_ns) {
+            ready = 0;
+            break;
+        }
+    }
+
+    long long left_ns = deadline_ns - monotonic_ns();
+    if (left_ns < 0) {
+        left_ns = 0;
+    }
+    timeout->tv_sec = left_ns / 1000000000LL;
+    timeout->tv_usec = (left_ns % 1000000000LL) / 1000;
+    return ready;
+}
+
+// Sleep until target_ns (CLOCK_MONOTONIC); low-jitter mode spins the last
+// PACE_SPIN_NS
+void sleep_until_ns(long long target_ns) {
+    if (!low_jitter) {
+        long long delay_ns = target_ns - monotonic_ns();
+        if (delay_ns > 0) {
+            usleep(delay_ns / 1000);
+        }
+        return;
+    }
+
+    long long wake_ns = target_ns - PACE_SPIN_NS;
+    if (wake_ns > monotonic_ns()) {
+        struct timespec ts = { wake_ns / 1000000000, wake_ns % 1000000000 };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    while (!stop_ping && monotonic_ns() < target_ns) {
+        // Spin
+    }
+}
+
+// Report the prober's own timing noise for the run
+void report_sched_noise(void) {
+    const latency_hist_t *late = &sched_noise.send_late;
+    if (late->count == 0) {
+        return;
+    }
+    log_message("Send lateness p50/p99/max = %.3f/%.3f/%.3f ms over %llu probes\n",
+                hist_percentile(late, 0.50), hist_percentile(late, 0.99), late->max,
+                (unsigned long long)late->count);
+    if (low_jitter) {
+        log_message("Prober stalls over %d us: %llu, longest %.3f ms, %d replies affected\n",
+                    STALL_NS / 1000, (unsigned long long)sched_noise.stalls,
+                    sched_noise.max_stall_ns / 1000000.0, sched_noise.stalled_replies);
+    }
+}
+
+// Retransmission timeout
+// -------------------------------------------------------------------
+// With -A, a probe is given up on (and retried) after an RTO computed as in
+// TCP: RTO = SRTT + 4 * RTTVAR, clamped to [-A floor, -w timeout] and doubled
+// for each retry of the same probe. Retries go out as soon as the RTO expires,
+// without the fixed RETRY_INTERVAL pause. Following Karn's algorithm only
+// replies to probes that were never retried update the estimate. A retry is
+// spurious if its reply echoes the timestamp of an earlier transmission; that
+// needs the payload to hold the whole timestamp (-s 24 or more).
+
+// Start a run's estimator; timeout is the -w limit in seconds
+void rto_init(rto_state_t *r, int timeout) {
+    memset(r, 0, sizeof(*r));
+    r->adaptive = rto_min_ms > 0;
+    r->min_rto = rto_min_ms;
+    r->max_rto = timeout * 1000.0;
+    r->rto = r->adaptive ? fmin(fmax(RTO_INITIAL_MS, r->min_rto), r->max_rto) : r->max_rto;
+}
+
+// Fold in an RTT (ms) measured on a probe that was sent only once
+void rto_sample(rto_state_t *r, double rtt) {
+    if (!r->adaptive) {
+        return;
+    }
+    if (!r->have_sample) {
+        r->srtt = rtt;
+        r->rttvar = rtt / 2;
+        r->have_sample = true;
+    } else {
+        r->rttvar = 0.75 * r->rttvar + 0.25 * fabs(r->srtt - rtt);
+        r->srtt = 0.875 * r->srtt + 0.125 * rtt;
+    }
+    r->rto = fmin(fmax(r->srtt + 4 * r->rttvar, r->min_rto), r->max_rto);
+}
+
+// How long to wait (us) for a reply to a probe's `tries`-th transmission
+long long rto_wait_us(rto_state_t *r, int tries) {
+    double wait = r->rto;
+    for (int i = 1; r->adaptive && i < tries && wait < r->max_rto; i++) {
+        wait *= 2;
+    }
+    wait = fmin(wait, r->max_rto);
+    hist_record(&r->armed, wait);
+    return (long long)(wait * 1000);
+}
+
+// Pause before a retry: the fixed RETRY_INTERVAL, none in adaptive mode (us)
+long long rto_retry_gap_us(const rto_state_t *r) {
+    return r->adaptive ? 0 : RETRY_INTERVAL * 1000;
+}
+
+// True if an echo reply carries a different send timestamp than `stamp`, the
+// one in the probe's latest transmission, i.e. it answers an earlier one
+bool answers_earlier_send(const struct icmphdr *icmp_header, int icmp_len, const unsigned char *stamp) {
+    if (icmp_len < (int)(sizeof(struct icmphdr) + sizeof(struct timeval))) {
+        return false;
+    }
+    return memcmp(icmp_header + 1, stamp, sizeof(struct timeval)) != 0;
+}
+
+// Account for a reply to a probe sent `tries` times: sample it, or judge the retry
+void rto_reply(rto_state_t *r, int tries, double rtt, bool earlier_send) {
+    if (tries <= 1) {
+        rto_sample(r, rtt);
+        return;
+    }
+    r->answered_retries++;
+    if (earlier_send) {
+        r->spurious_retries++;
+    }
+}
+
+// Report the timeouts used and how many retries were unnecessary
+void report_rto(const rto_state_t *r) {
+    if (r->adaptive && r->armed.count > 0 && !r->have_sample) {
+        log_message("Adaptive RTO: no first transmission was answered, stayed at %.3f ms\n", r->rto);
+    } else if (r->adaptive && r->armed.count > 0) {
+        log_message("Adaptive RTO: srtt = %.3f ms, rttvar = %.3f ms, rto = %.3f ms (bounds %.3f-%.0f ms); "
+                    "waits p50/p99/max = %.3f/%.3f/%.3f ms\n",
+                    r->srtt, r->rttvar, r->rto, r->min_rto, r->max_rto,
+                    hist_percentile(&r->armed, 0.50), hist_percentile(&r->armed, 0.99), r->armed.max);
+    }
+    if (r->answered_retries > 0) {
+        log_message("Spurious retries: %d of %d answered retries (%.1f%%) were replied to on an earlier "
+                    "transmission\n", r->spurious_retries, r->answered_retries,
+                    r->spurious_retries * 100.0 / r->answered_retries);
+    }
+}
+
+// Stop-and-wait engine
+// -------------------------------------------------------------------
+// The original ping loop: send one probe, wait for its reply for the fixed -w
+// timeout, or the backed-off RTO with -A (see rto_wait_us), retrying up to
+// `retries` times, then sleep `interval` ms
+void run_stop_and_wait(char *packet, int packet_size, int count, int interval, int retries) {
+    // The packet is built once and restamped for every send
+    int seq_num = 0;
+    long long intended_ns = 0; // When the interval sleep meant the next probe to leave
+    prepare_icmp_packet((struct icmphdr *)packet, seq_num, packet_size);
+    while (!stop_ping && (count == -1 || stats.original_send_count < count)) {
+        // Flush socket before sending (NEW CODE)
+        flush_socket(sockfd);
+        
+        // Prepare packet
+        restamp_icmp_packet((struct icmphdr *)packet, seq_num, packet_size);
+        
+        // Add packet to history
+        add_packet_to_history(seq_num);
+        stats.original_send_count++;
+        
+        // Try sending the packet (with retries if needed)
+        bool packet_received = false;
+        int current_tries = 0;
+        
+        while (!stop_ping && !packet_received && current_tries <= retries) {
+            if (current_tries > 0) {
+                // This is a retry
+                stats.resend_count++;
+                
+                // Update retry count in history
+                packet_history_t *pkt = find_packet(seq_num);
+                if (pkt) {
+                    pkt->retries++;
+                }
+                
+                // Prepare packet again with same sequence number
+                restamp_icmp_packet((struct icmphdr *)packet, seq_num, packet_size);
+                
+                // Log retry
+                log_verbose(LOG_EVENTS, "Retrying seq=%d (attempt %d/%d)\n", seq_num, current_tries, retries);
+            }
+            
+            // Send packet and record send time
+            probe_stall_ns = 0;
+            long long send_ns = send_probe(packet, packet_size, seq_num);
+            if (current_tries == 0 && intended_ns != 0) {
+                note_send_lateness(intended_ns, send_ns);
+            }
+
+            // Receive buffer
+            char recv_packet[MAX_PACKET_SIZE];
+            struct sockaddr_in recv_addr;
+            
+            // Loop to handle possible multiple responses (e.g., ICMP error messages)
+            struct timeval wait_time;
+            bool response_received = false;
+            
+            // Set wait time for select(): the fixed timeout, or the backed-off RTO with -A
+            long long wait_usec = rto_wait_us(&rto, current_tries + 1);
+            wait_time.tv_sec = wait_usec / 1000000;
+            wait_time.tv_usec = wait_usec % 1000000;
+            
+            // Track when we started waiting (NEW CODE)
+            struct timeval wait_start;
+            gettimeofday(&wait_start, NULL);
+            
+            // Remaining wait time (NEW CODE)
+            struct timeval remaining_time = wait_time;
+            
+            // Keep trying to receive until timeout (NEW CODE)
+            while (!response_received) {
+                // Wait up to remaining time for data to be available
+                int ready = wait_readable(sockfd, &remaining_time);
+                
+                // Check if we timed out
+                if (ready <= 0) {
+                    break; // Timeout or error
+                }
+                
+                // Collect TX timestamps first, the error queue also wakes select()
+                drain_tx_timestamps(sockfd);
+                
+                // Try to receive
+                long long kernel_rx_ns;
+                int bytes_received = receive_datagram(sockfd, recv_packet, sizeof(recv_packet), MSG_DONTWAIT,
+                                                      &recv_addr, &kernel_rx_ns);
+                
+                if (bytes_received <= 0) {
+                    continue; // Error receiving packet, try again
+                }
+                
+                // Record receive time
+                long long recv_ns = monotonic_ns();
+                
+                // Calculate round-trip time in milliseconds
+                double rtt = probe_rtt(seq_num, send_ns, recv_ns, kernel_rx_ns);
+                
+                // Parse IP header and ICMP header
+                struct iphdr *ip_header = (struct iphdr *)recv_packet;
+                int ip_header_len = ip_header->ihl * 4;  // IP header length
+                
+                // Validate we have enough data for an ICMP header
+                if (bytes_received < ip_header_len + sizeof(struct icmphdr)) {
+                    continue; // Packet too small, try again
+                }
+                
+                struct icmphdr *icmp_header = (struct icmphdr *)(recv_packet + ip_header_len);
+                int data_size = bytes_received - ip_header_len - sizeof(struct icmphdr);
+                
+                // Check if it's our echo reply - STRICT VALIDATION
+                if (icmp_header->type == ICMP_ECHOREPLY &&
+                    icmp_header->un.echo.id == ident &&
+                    icmp_header->un.echo.sequence == (seq_num & 0xFFFF) &&
+                    recv_addr.sin_addr.s_addr == dest_addr.sin_addr.s_addr) {
+                    
+                    // Sanity check for RTT - reject impossibly fast responses
+                    // Even loopback shouldn't be less than ~0.05ms
+                    if (rtt < 0.05 && strcmp(inet_ntoa(recv_addr.sin_addr), "127.0.0.1") != 0) {
+                        log_verbose(LOG_REPLIES, "Suspicious RTT (%.3f ms) from %s for icmp_seq=%d - ignoring\n",
+                                  rtt, inet_ntoa(recv_addr.sin_addr), seq_num);
+                        continue; // Try for another packet
+                    }
+                    
+                    stats.recv_count++;
+                    packet_received = true;
+                    response_received = true;
+                    rto_reply(&rto, current_tries + 1, rtt,
+                              answers_earlier_send(icmp_header, bytes_received - ip_header_len,
+                                                   (const unsigned char *)((struct icmphdr *)packet + 1)));
+                    
+                    // Verify checksum and data integrity
+                    bool checksum_valid = verify_checksum((unsigned short *)icmp_header, 
+                                                        bytes_received - ip_header_len);
+                    bool data_valid = data_size > 0 ? 
+                                      verify_packet_integrity(icmp_header, data_size) : true;
+                    bool is_corrupted = !checksum_valid || !data_valid;
+                    
+                    if (is_corrupted) {
+                        stats.corrupt_count++;
+                    }
+                    
+                    // Update packet history
+                    update_packet_history(seq_num, rtt, is_corrupted, bytes_received - ip_header_len,
+                                          ip_header->ttl);
+                    
+                    // Print information
+                    log_reply(bytes_received - ip_header_len, &recv_addr, seq_num,
+                              ip_header->ttl, rtt, is_corrupted, checksum_valid, data_valid);
+                    if (probe_stall_ns > 0) {
+                        sched_noise.stalled_replies++;
+                        log_verbose(LOG_EVENTS, "RTT of icmp_seq=%d includes a %.3f ms stall of the prober\n",
+                                    seq_num, probe_stall_ns / 1000000.0);
+                    }
+                }
+                else if (icmp_header->type == ICMP_DEST_UNREACH) {
+                    // Handle destination unreachable message
+                    note_icmp_error(seq_num, ICMP_DEST_UNREACH);
+                    log_verbose(LOG_EVENTS, "From %s: Destination unreachable (code=%d) for icmp_seq=%d\n",
+                              inet_ntoa(recv_addr.sin_addr),
+                              icmp_header->code,
+                              seq_num);
+                }
+                else if (icmp_header->type == ICMP_TIME_EXCEEDED) {
+                    // Handle time exceeded message
+                    note_icmp_error(seq_num, ICMP_TIME_EXCEEDED);
+                    log_verbose(LOG_EVENTS, "From %s: Time to live exceeded for icmp_seq=%d\n",
+                              inet_ntoa(recv_addr.sin_addr),
+                              seq_num);
+                }
+                
+                // Calculate remaining wait time
+                struct timeval current_time;
+                gettimeofday(&current_time, NULL);
+                
+                // Calculate elapsed time
+                long elapsed_usec = (current_time.tv_sec - wait_start.tv_sec) * 1000000 + 
+                                    (current_time.tv_usec - wait_start.tv_usec);
+                
+                // Calculate remaining time
+                long remaining_usec = wait_usec - elapsed_usec;
+                
+                if (remaining_usec <= 0) {
+                    break; // We've exceeded our timeout
+                }
+                
+                // Update remaining_time for next select call
+                remaining_time.tv_sec = remaining_usec / 1000000;
+                remaining_time.tv_usec = remaining_usec % 1000000;
+            }
+            
+            if (!response_received && stop_ping) {
+                break; // Interrupted while waiting
+            }
+            if (!response_received) {
+                log_verbose(LOG_EVENTS, "Request timeout for icmp_seq=%d (try %d/%d)\n", 
+                          seq_num, current_tries + 1, retries + 1);
+            }
+            
+            current_tries++;
+            
+            // If packet received or max retries reached, move to next sequence
+            if (packet_received || current_tries > retries) {
+                break;
+            }
+            
+            // Wait before retry
+            usleep(rto_retry_gap_us(&rto));
+        }
+
+        seq_num++;
+
+        // Check if we've reached the requested count, or were stopped
+        if (stop_ping || (count != -1 && stats.original_send_count >= count)) {
+            break;
+        }
+
+        // Sleep for the interval before sending the next packet
+        intended_ns = monotonic_ns() + (long long)interval * 1000000;
+        sleep_until_ns(intended_ns);
+    }
+}
+
+// Timer wheel
+// -------------------------------------------------------------------
+// Outstanding probes' timeouts and retries live in a hierarchical timer wheel
+// with 1 us ticks, so scheduling and cancelling are O(1) however many probes
+// are in flight. Level l has 64 buckets of 64^l ticks. A timer sits at the
+// level of the highest base-64 digit in which its expiry differs from `now`,
+// in the bucket for that digit. When `now` enters a bucket above level 0, its
+// timers are moved down (cascaded). Empty stretches are skipped using the
+// per-level occupancy bitmaps, so the loop can sleep until the next tick at
+// which the wheel has anything to do: an expiry, or a cascade just before one.
+
+#define WHEEL_MASK ((1 << WHEEL_BITS) - 1)
+
+// Start an empty wheel at tick 0 = now_us
+void wheel_init(timer_wheel_t *w, long long now_us) {
+    memset(w, 0, sizeof(*w));
+    for (int l = 0; l < WHEEL_LEVELS; l++) {
+        for (int b = 0; b <= WHEEL_MASK; b++) {
+            w->buckets[l][b].next = w->buckets[l][b].prev = &w->buckets[l][b];
+        }
+    }
+    w->origin_us = now_us;
+}
+
+// Link a timer into the bucket for its expiry
+void wheel_link(timer_wheel_t *w, wheel_timer_t *t) {
+    if (t->expires < w->now) {
+        t->expires = w->now; // Already due: fire on the next pass
+    }
+    int level = 0;
+    unsigned long long diff = t->expires ^ w->now;
+    if (diff > WHEEL_MASK) {
+        level = (63 - __builtin_clzll(diff)) / WHEEL_BITS;
+    }
+    int bucket = (t->expires >> (level * WHEEL_BITS)) & WHEEL_MASK;
+    wheel_timer_t *head = &w->buckets[level][bucket];
+    t->next = head;
+    t->prev = head->prev;
+    head->prev->next = t;
+    head->prev = t;
+    w->occupied[level] |= 1ULL << bucket;
+}
+
+// Unlink a timer, keeping the occupancy bitmap of its bucket right
+void wheel_unlink(timer_wheel_t *w, wheel_timer_t *t) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    if (t->next == t->prev && t->next->next == t->next) {
+        // It was the bucket's only timer, so both neighbours are the head,
+        // whose position in the array says which bucket it is
+        int index = t->next - &w->buckets[0][0];
+        w->occupied[index >> WHEEL_BITS] &= ~(1ULL << (index & WHEEL_MASK));
+    }
+    t->next = t->prev = NULL;
+}
+
+// Schedule (or reschedule) a timer for absolute time at_us (CLOCK_MONOTONIC)
+void wheel_schedule(timer_wheel_t *w, wheel_timer_t *t, long long at_us) {
+    if (t->next) {
+        wheel_unlink(w, t);
+    } else {
+        w->count++;
+    }
+    t->expires = at_us - w->origin_us;
+    if (t->expires >= 1LL << (WHEEL_LEVELS * WHEEL_BITS)) {
+        t->expires = (1LL << (WHEEL_LEVELS * WHEEL_BITS)) - 1; // The end of the wheel's span
+    }
+    wheel_link(w, t);
+}
+
+// Cancel a timer if it is scheduled
+void wheel_cancel(timer_wheel_t *w, wheel_timer_t *t) {
+    if (t->next) {
+        wheel_unlink(w, t);
+        w->count--;
+    }
+}
+
+// Earliest tick at which the wheel has work: a level 0 expiry, or the start
+// of a higher bucket that must be cascaded. LLONG_MAX if it is empty.
+long long wheel_next_tick(const timer_wheel_t *w) {
+    for (int l = 0; l < WHEEL_LEVELS; l++) {
+        int shift = l * WHEEL_BITS;
+        int digit = (w->now >> shift) & WHEEL_MASK;
+        // Level 0 buckets from `now` on; above that, only buckets not yet entered
+        uint64_t ahead = l == 0 ? ~0ULL << digit : (digit == WHEEL_MASK ? 0 : ~0ULL << (digit + 1));
+        uint64_t pending = w->occupied[l] & ahead;
+        if (pending) {
+            // Lower levels come before higher ones, so the first hit is the earliest
+            long long base = (w->now >> (shift + WHEEL_BITS)) << (shift + WHEEL_BITS);
+            return base | ((long long)__builtin_ctzll(pending) << shift);
+        }
+    }
+    return LLONG_MAX;
+}
+
+// CLOCK_MONOTONIC time (us) of the wheel's next work, LLONG_MAX if none
+long long wheel_next_us(const timer_wheel_t *w) {
+    long long tick = wheel_next_tick(w);
+    return tick == LLONG_MAX ? LLONG_MAX : w->origin_us + tick;
+}
+
+// Move the timers of every bucket `now` has just entered down the wheel
+void wheel_cascade(timer_wheel_t *w) {
+    for (int l = WHEEL_LEVELS - 1; l > 0; l--) {
+        int bucket = (w->now >> (l * WHEEL_BITS)) & WHEEL_MASK;
+        if (!(w->occupied[l] & (1ULL << bucket))) {
+            continue;
+        }
+        wheel_timer_t *head = &w->buckets[l][bucket];
+        wheel_timer_t *t = head->next;
+        head->next = head->prev = head;
+        w->occupied[l] &= ~(1ULL << bucket);
+        while (t != head) {
+            wheel_timer_t *next = t->next;
+            wheel_link(w, t);
+            t = next;
+        }
+    }
+}
+
+// Unschedule and return a timer that has expired by now_us, NULL if none has
+wheel_timer_t *wheel_expire(timer_wheel_t *w, long long now_us) {
+    long long target = now_us - w->origin_us;
+    while (w->now <= target) {
+        wheel_timer_t *head = &w->buckets[0][w->now & WHEEL_MASK];
+        if (head->next != head) {
+            wheel_timer_t *t = head->next;
+            wheel_unlink(w, t);
+            w->count--;
+            return t;
+        }
+
+        // Skip to the next tick with work (or just past target, if that is
+        // sooner); entering a higher bucket there cascades it
+        long long next = wheel_next_tick(w);
+        w->now = next > target ? target + 1 : next;
+        wheel_cascade(w);
+    }
+    return NULL;
+}
+
+// Pipelined send/receive engine
+// -------------------------------------------------------------------
+// Send one probe (first transmission or retry) from an in-flight slot
+void send_pipelined_probe(pipeline_t *p, inflight_slot_t *slot) {
+    restamp_icmp_packet((struct icmphdr *)p->packet, slot->seq_num, p->packet_size);
+    slot->sent_ns = p->transmit(p->packet, p->packet_size, slot->seq_num);
+
+    memcpy(slot->stamp, (struct icmphdr *)p->packet + 1, sizeof(slot->stamp));
+    slot->tries++;
+    slot->awaiting_retry = false;
+    wheel_schedule(&p->wheel, &slot->timer, current_timestamp_us() + rto_wait_us(&rto, slot->tries));
+}
+
+// Strip the IP header from a raw socket datagram; NULL if too short for ICMP
+struct icmphdr *parse_icmp_packet(char *recv_packet, int bytes_received, int *icmp_len, int *ttl) {
+    struct iphdr *ip_header = (struct iphdr *)recv_packet;
+    int ip_header_len = ip_header->ihl * 4;
+    if (bytes_received < ip_header_len + sizeof(struct icmphdr)) {
+        return NULL;
+    }
+    *icmp_len = bytes_received - ip_header_len;
+    *ttl = ip_header->ttl;
+    return (struct icmphdr *)(recv_packet + ip_header_len);
+}
+
+// For an ICMP error, return the echo request it quotes if it is one of ours
+struct icmphdr *quoted_probe(struct icmphdr *icmp_header, int icmp_len, struct iphdr **inner_ip) {
+    if (icmp_header->type != ICMP_DEST_UNREACH && icmp_header->type != ICMP_TIME_EXCEEDED) {
+        return NULL;
+    }
+
+    // The embedded original header tells us which probe failed
+    int data_size = icmp_len - sizeof(struct icmphdr);
+    *inner_ip = (struct iphdr *)(icmp_header + 1);
+    if (data_size < sizeof(struct iphdr) ||
+        data_size < (*inner_ip)->ihl * 4 + sizeof(struct icmphdr)) {
+        return NULL;
+    }
+    struct icmphdr *inner_icmp = (struct icmphdr *)((char *)*inner_ip + (*inner_ip)->ihl * 4);
+    return inner_icmp->un.echo.id == ident ? inner_icmp : NULL;
+}
+
+// Parse a datagram from the raw socket. Returns the ICMP header if it is an echo
+// reply to us from the target, with its unwrapped sequence number; ICMP errors
+// quoting one of our probes are logged, and anything else is ignored (NULL).
+struct icmphdr *parse_echo_reply(char *recv_packet, int bytes_received, struct sockaddr_in *recv_addr,
+                                 int *icmp_len, int *ttl, int *seq_num) {
+    struct icmphdr *icmp_header = parse_icmp_packet(recv_packet, bytes_received, icmp_len, ttl);
+    if (!icmp_header) {
+        return NULL;
+    }
+
+    struct iphdr *inner_ip;
+    struct icmphdr *inner_icmp = quoted_probe(icmp_header, *icmp_len, &inner_ip);
+    if (inner_icmp) {
+        note_icmp_error(unwrap_sequence(inner_icmp->un.echo.sequence), icmp_header->type);
+        if (icmp_header->type == ICMP_DEST_UNREACH) {
+            log_verbose(LOG_EVENTS, "From %s: Destination unreachable (code=%d) for icmp_seq=%d\n",
+                        inet_ntoa(recv_addr->sin_addr), icmp_header->code,
+                        inner_icmp->un.echo.sequence);
+        } else {
+            log_verbose(LOG_EVENTS, "From %s: Time to live exceeded for icmp_seq=%d\n",
+                        inet_ntoa(recv_addr->sin_addr), inner_icmp->un.echo.sequence);
+        }
+        return NULL;
+    }
+
+    if (icmp_header->type != ICMP_ECHOREPLY ||
+        icmp_header->un.echo.id != ident ||
+        recv_addr->sin_addr.s_addr != dest_addr.sin_addr.s_addr) {
+        return NULL;
+    }
+
+    *seq_num = unwrap_sequence(icmp_header->un.echo.sequence);
+    if (*seq_num < 0) {
+        return NULL;
+    }
+    return icmp_header;
+}
+
+// Verify checksum and data integrity of an echo reply; returns true if corrupted
+bool reply_corrupted(struct icmphdr *icmp_header, int icmp_len, bool *checksum_valid, bool *data_valid) {
+    int data_size = icmp_len - sizeof(struct icmphdr);
+    *checksum_valid = verify_checksum((unsigned short *)icmp_header, icmp_len);
+    *data_valid = data_size > 0 ? verify_packet_integrity(icmp_header, data_size) : true;
+    return !*checksum_valid || !*data_valid;
+}
+
+// Account for a matched echo reply: verify it, update stats and history, and log it
+void record_reply(struct icmphdr *icmp_header, int icmp_len, int ttl,
+                  struct sockaddr_in *recv_addr, int seq_num, double rtt) {
+    stats.recv_count++;
+
+    bool checksum_valid, data_valid;
+    bool is_corrupted = reply_corrupted(icmp_header, icmp_len, &checksum_valid, &data_valid);
+    if (is_corrupted) {
+        stats.corrupt_count++;
+    }
+
+    update_packet_history(seq_num, rtt, is_corrupted, icmp_len, ttl);
+    log_reply(icmp_len, recv_addr, seq_num, ttl, rtt, is_corrupted, checksum_valid, data_valid);
+}
+
+// Match one received datagram against the in-flight window
+// Returns true if it answered one of our outstanding probes
+bool process_pipelined_reply(pipeline_t *p, char *recv_packet, int bytes_received,
+                             struct sockaddr_in *recv_addr, long long kernel_rx_ns) {
+    long long recv_ns = monotonic_ns();
+
+    int icmp_len, ttl, seq;
+    struct icmphdr *icmp_header = parse_echo_reply(recv_packet, bytes_received, recv_addr,
+                                                   &icmp_len, &ttl, &seq);
+    if (!icmp_header) {
+        return false;
+    }
+
+    // Look up the slot this sequence number maps to (late or duplicate replies miss)
+    inflight_slot_t *slot = &p->slots[seq % p->window];
+    if (!slot->active || slot->seq_num != seq) {
+        return false;
+    }
+
+    // Open loop: measure from when the probe should have gone out, so a stall
+    // that delayed sending shows up in the latencies (coordinated omission)
+    double rtt = p->open_loop ? (recv_ns - slot->intended_ns) / 1000000.0
+                              : probe_rtt(seq, slot->sent_ns, recv_ns, kernel_rx_ns);
+    slot->active = false;
+    wheel_cancel(&p->wheel, &slot->timer);
+    p->in_flight--;
+    rto_reply(&rto, slot->tries, rtt, answers_earlier_send(icmp_header, icmp_len, slot->stamp));
+    record_reply(icmp_header, icmp_len, ttl, recv_addr, seq, rtt);
+    return true;
+}
+
+// Keep up to `window` probes in flight: the sender transmits every `interval` ms
+// while replies are matched to their slot by sequence number as they arrive.
+// A new sequence number is only sent once its slot (seq % window) is free, so a
+// probe stuck in retries holds the window back like an unacked TCP segment.
+bool pipeline_init(pipeline_t *p, char *packet, int packet_size, int count, int interval,
+                   int timeout, int retries, int window) {
+    memset(p, 0, sizeof(*p));
+    p->slots = calloc(window, sizeof(inflight_slot_t));
+    if (!p->slots) {
+        perror("Failed to allocate in-flight window");
+        return false;
+    }
+    p->window = window;
+    p->packet = packet;
+    p->packet_size = packet_size;
+    p->count = count;
+    p->period_ns = (long long)interval * 1000000;
+    p->timeout = timeout;
+    p->retries = retries;
+    p->next_send_ns = monotonic_ns();
+    p->transmit = send_probe;
+    wheel_init(&p->wheel, current_timestamp_us());
+    prepare_icmp_packet((struct icmphdr *)packet, 0, packet_size); // Restamped per send
+    return true;
+}
+
+// Expire timeouts, send retries and new probes that are due, and work out when
+// the pipeline next needs attention (wake_ns, CLOCK_MONOTONIC). Returns false
+// once the run is complete.
+bool pipeline_service(pipeline_t *p, long long *wake_ns) {
+    long long now_ns, now_us;
+    bool more_to_send;
+
+    while (1) {
+        now_ns = monotonic_ns();
+        now_us = now_ns / 1000;
+        more_to_send = p->count == -1 || stats.original_send_count < p->count;
+
+        // Expire timed-out probes and resend those due for a retry
+        wheel_timer_t *timer;
+        while ((timer = wheel_expire(&p->wheel, now_us)) != NULL) {
+            inflight_slot_t *slot = (inflight_slot_t *)((char *)timer - offsetof(inflight_slot_t, timer));
+            if (slot->awaiting_retry) {
+                stats.resend_count++;
+                packet_history_t *pkt = find_packet(slot->seq_num);
+                if (pkt) {
+                    pkt->retries++;
+                }
+                log_verbose(LOG_EVENTS, "Retrying seq=%d (attempt %d/%d)\n", slot->seq_num, slot->tries, p->retries);
+                send_pipelined_probe(p, slot);
+                continue;
+            }
+
+            log_verbose(LOG_EVENTS, "Request timeout for icmp_seq=%d (try %d/%d)\n",
+                        slot->seq_num, slot->tries, p->retries + 1);
+
+            if (slot->tries > p->retries) {
+                slot->active = false;
+                p->in_flight--;
+            } else {
+                slot->awaiting_retry = true;
+                wheel_schedule(&p->wheel, &slot->timer, now_us + rto_retry_gap_us(&rto));
+            }
+        }
+
+        // Send the next probe if it is due and the window has room
+        inflight_slot_t *slot = &p->slots[p->seq_num % p->window];
+        if (!more_to_send || now_ns < p->next_send_ns || slot->active) {
+            break;
+        }
+
+        slot->active = true;
+        p->in_flight++;
+        slot->seq_num = p->seq_num;
+        slot->tries = 0;
+        slot->intended_ns = p->next_send_ns;
+
+        add_packet_to_history(p->seq_num);
+        stats.original_send_count++;
+        send_pipelined_probe(p, slot);
+        p->seq_num++;
+
+        if (p->first_send_ns == 0) {
+            p->first_send_ns = now_ns;
+        }
+        p->last_send_ns = now_ns;
+        note_send_lateness(slot->intended_ns, now_ns);
+        if (now_ns - slot->intended_ns > PACE_LATE_NS) {
+            p->late_count++;
+        }
+        if (now_ns - slot->intended_ns > p->max_late_ns) {
+            p->max_late_ns = now_ns - slot->intended_ns;
+        }
+
+        // Stay on the fixed schedule. Closed loop doesn't burst to catch up
+        // after a stall; open loop does, so the offered load stays constant.
+        p->next_send_ns += p->period_ns;
+        if (!p->open_loop && p->next_send_ns < now_ns) {
+            p->next_send_ns = now_ns;
+        }
+    }
+
+    // Done once everything has been sent and answered or given up on
+    if (!more_to_send && p->in_flight == 0) {
+        return false;
+    }
+
+    // Wake for the next send, timeout or retry
+    *wake_ns = now_ns + (long long)p->timeout * 1000000000;
+    if (more_to_send && !p->slots[p->seq_num % p->window].active && p->next_send_ns < *wake_ns) {
+        *wake_ns = p->next_send_ns;
+    }
+    long long timer_us = wheel_next_us(&p->wheel);
+    if (timer_us != LLONG_MAX && timer_us * 1000 < *wake_ns) {
+        *wake_ns = timer_us * 1000;
+    }
+    return true;
+}
+
+// Switch the pipeline to open-loop pacing at `pps` probes per second
+void pipeline_pace(pipeline_t *p, double pps) {
+    p->open_loop = true;
+    p->period_ns = (long long)(1000000000.0 / pps);
+}
+
+// Compare the rate the pipeline achieved with the one it was asked for
+void report_pacing(pipeline_t *p, double pps, int packet_size) {
+    if (!p->open_loop) {
+        return;
+    }
+
+    // Rates count the whole IP datagram
+    double bits = (packet_size + sizeof(struct iphdr)) * 8.0;
+    int sent = p->seq_num;
+    double achieved = sent > 1 && p->last_send_ns > p->first_send_ns
+                      ? (sent - 1) * 1000000000.0 / (p->last_send_ns - p->first_send_ns) : 0;
+    log_message("Pacing: requested %.0f pps (%.3f Mbps), achieved %.1f pps (%.3f Mbps); "
+                "%d of %d probes sent more than %d us late, worst %.3f ms\n",
+                pps, pps * bits / 1e6, achieved, achieved * bits / 1e6,
+                p->late_count, sent, PACE_LATE_NS / 1000, p->max_late_ns / 1000000.0);
+}
+
+// Receive everything queued on the raw socket without blocking
+void drain_pipelined_replies(pipeline_t *p) {
+    char recv_packet[MAX_PACKET_SIZE];
+
+    drain_tx_timestamps(sockfd);
+    while (1) {
+        struct sockaddr_in recv_addr;
+        long long kernel_rx_ns;
+        int bytes_received = receive_datagram(sockfd, recv_packet, sizeof(recv_packet), MSG_DONTWAIT,
+                                              &recv_addr, &kernel_rx_ns);
+        if (bytes_received <= 0) {
+            break;
+        }
+        process_pipelined_reply(p, recv_packet, bytes_received, &recv_addr, kernel_rx_ns);
+    }
+}
+
+// Pipelined mode over select() and non-blocking recvmsg(). Sleeps on a timerfd
+// armed for the absolute wake time. In paced mode (pps > 0, new probes sent
+// open loop instead of every `interval` ms) the timer fires PACE_SPIN_NS early
+// and the rest of the gap is busy-waited, polling the socket meanwhile, since
+// timer wakeups are only accurate to tens of microseconds. Low-jitter mode
+// busy-waits every gap.
+void run_pipelined(char *packet, int packet_size, int count, int interval,
+                   int timeout, int retries, int window, double pps) {
+    pipeline_t p;
+    if (!pipeline_init(&p, packet, packet_size, count, interval, timeout, retries, window)) {
+        return;
+    }
+    if (pps > 0) {
+        pipeline_pace(&p, pps);
+    }
+
+    int tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+    if (tfd < 0) {
+        perror("timerfd_create failed");
+        free(p.slots);
+        return;
+    }
+
+    long long wake_ns;
+    while (!stop_ping && pipeline_service(&p, &wake_ns)) {
+        long long sleep_ns = p.open_loop ? wake_ns - PACE_SPIN_NS : wake_ns;
+        if (low_jitter || sleep_ns <= monotonic_ns()) {
+            long long last_ns = 0;
+            while (!stop_ping && poll_pass(&last_ns) < wake_ns) {
+                drain_pipelined_replies(&p);
+            }
+            continue;
+        }
+
+        // Sleep until the pipeline needs attention, or until a reply arrives
+        struct itimerspec its = {0};
+        its.it_value.tv_sec = sleep_ns / 1000000000;
+        its.it_value.tv_nsec = sleep_ns % 1000000000;
+        timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+
+        fd_set read_set;
+        FD_ZERO(&read_set);
+        FD_SET(sockfd, &read_set);
+        FD_SET(tfd, &read_set);
+        if (select((sockfd > tfd ? sockfd : tfd) + 1, &read_set, NULL, NULL, NULL) <= 0) {
+            continue;
+        }
+        if (FD_ISSET(tfd, &read_set)) {
+            uint64_t expirations;
+            if (read(tfd, &expirations, sizeof(expirations)) < 0) {
+                // Nothing to do, the timer is re-armed every pass
+            }
+        }
+        if (FD_ISSET(sockfd, &read_set)) {
+            drain_pipelined_replies(&p);
+        }
+    }
+
+    report_pacing(&p, pps, packet_size);
+    close(tfd);
+    free(p.slots);
+}
+
+// io_uring backend
+// -------------------------------------------------------------------
+// Drives the pipelined engine through io_uring instead of select()/recvmsg():
+// one multishot RECVMSG fills buffers from a provided-buffer ring, probes go
+// out as SENDMSG SQEs hard-linked so a burst stays in order, and an absolute
+// TIMEOUT SQE wakes the loop for the next send, retry or expiry. Each pass is
+// a single io_uring_enter() that submits everything and sleeps for completions.
+// Uses raw syscalls, so there is no liburing dependency.
+
+// Ring and buffer state for the io_uring backend
+typedef struct {
+    int fd;
+    unsigned sq_entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    unsigned sqe_tail;                  // Next SQE to fill (published on submit)
+    unsigned submitted_tail;            // SQ tail the kernel has been told about
+
+    struct io_uring_buf_ring *buf_ring; // Provided receive buffers
+    size_t buf_ring_size;
+    unsigned short buf_tail;
+    char *recv_buffers;
+    int recv_buffer_size;
+    struct msghdr recv_msg;             // Layout template for multishot recvmsg
+    bool recv_armed;
+
+    char *send_buffers;                 // Probe copies owned by in-flight SENDMSGs
+    bool send_busy[URING_SEND_BUFS];
+    struct msghdr send_msgs[URING_SEND_BUFS];
+    struct iovec send_iovs[URING_SEND_BUFS];
+    struct io_uring_sqe *last_send;     // Previous send in this submission, for linking
+    // Receive completions reaped while a send waited for a free copy, handled
+    // on the next pass. Each holds a provided buffer, so there are at most
+    // URING_BUFFERS of them plus the -ENOBUFS that ends the multishot.
+    struct io_uring_cqe deferred[URING_BUFFERS + 1];
+    int deferred_count;
+
+    long long timeout_armed_ns;         // Deadline of the pending TIMEOUT SQE (0 = none)
+    struct __kernel_timespec timeout_ts;
+} uring_t;
+
+uring_t uring = { .fd = -1 };
+
+// Hand queued SQEs to the kernel and optionally wait for completions
+int uring_enter(unsigned min_complete) {
+    unsigned to_submit = uring.sqe_tail - uring.submitted_tail;
+    __atomic_store_n(uring.sq_tail, uring.sqe_tail, __ATOMIC_RELEASE);
+    uring.submitted_tail = uring.sqe_tail;
+    uring.last_send = NULL;
+
+    int ret = syscall(__NR_io_uring_enter, uring.fd, to_submit, min_complete,
+                      min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    return ret < 0 && errno != EINTR ? -1 : 0;
+}
+
+// Get a zeroed SQE, flushing the queue to the kernel if it is full
+struct io_uring_sqe *uring_get_sqe() {
+    if (uring.sqe_tail - __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE) >= uring.sq_entries) {
+        uring_enter(0);
+    }
+    unsigned index = uring.sqe_tail & *uring.sq_mask;
+    uring.sq_array[index] = index;
+    uring.sqe_tail++;
+
+    struct io_uring_sqe *sqe = &uring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// Return a receive buffer to the kernel's provided-buffer ring
+void uring_provide_buffer(unsigned short bid) {
+    struct io_uring_buf *buf = &uring.buf_ring->bufs[uring.buf_tail & (URING_BUFFERS - 1)];
+    buf->addr = (uintptr_t)(uring.recv_buffers + (size_t)bid * uring.recv_buffer_size);
+    buf->len = uring.recv_buffer_size;
+    buf->bid = bid;
+    uring.buf_tail++;
+    __atomic_store_n(&uring.buf_ring->tail, uring.buf_tail, __ATOMIC_RELEASE);
+}
+
+// Arm the multishot receive; it stays active until the buffer ring runs dry
+void uring_arm_recv() {
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = sockfd;
+    sqe->addr = (uintptr_t)&uring.recv_msg;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = URING_UD_RECV;
+    uring.recv_armed = true;
+}
+
+// Arm a TIMEOUT SQE for an absolute CLOCK_MONOTONIC deadline in nanoseconds
+void uring_arm_timeout(long long wake_ns) {
+    uring.timeout_ts.tv_sec = wake_ns / 1000000000;
+    uring.timeout_ts.tv_nsec = wake_ns % 1000000000;
+
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = (uintptr_t)&uring.timeout_ts;
+    sqe->len = 1;
+    sqe->timeout_flags = IORING_TIMEOUT_ABS;
+    sqe->user_data = ((unsigned long long)(wake_ns / 1000) << 8) | URING_UD_TIMEOUT;
+    uring.timeout_armed_ns = wake_ns;
+}
+
+void uring_reap(pipeline_t *p);
+
+// Index of a probe copy no SENDMSG owns, or -1
+int uring_free_send_slot() {
+    for (int i = 0; i < URING_SEND_BUFS; i++) {
+        if (!uring.send_busy[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Pipeline transmit hook: queue a SENDMSG SQE instead of calling sendto()
+long long uring_send_probe(char *packet, int packet_size, int seq_num) {
+    // With every copy in use, submit the queued sends and reap until one
+    // completes. Sending inline would overtake them and give the TX timestamps
+    // the wrong OPT_IDs.
+    int slot;
+    while ((slot = uring_free_send_slot()) < 0) {
+        if (uring_enter(1) < 0) {
+            perror("io_uring_enter failed");
+            return send_probe(packet, packet_size, seq_num);
+        }
+        uring_reap(NULL);
+    }
+
+    uring.send_busy[slot] = true;
+    memcpy(uring.send_iovs[slot].iov_base, packet, packet_size);
+    uring.send_iovs[slot].iov_len = packet_size;
+
+    packet_history_t *pkt = find_packet(seq_num);
+    if (kernel_timestamps && pkt) {
+        pkt->tx_ns = realtime_ns();
+    }
+    long long sent_ns = monotonic_ns();
+    if (pkt) {
+        pkt->sent_ns = sent_ns;
+    }
+
+    // Linked sends execute in queue order, so OPT_IDs can be assigned now and
+    // TX timestamps drained before the send completions are reaped
+    if (kernel_tx_timestamps) {
+        tx_id_seq[tx_id_next & (HISTORY_SIZE - 1)] = seq_num;
+        tx_id_next++;
+    }
+
+    // Hard links keep a burst in order without cancelling it if one send fails
+    if (uring.last_send) {
+        uring.last_send->flags |= IOSQE_IO_HARDLINK;
+    }
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = sockfd;
+    sqe->addr = (uintptr_t)&uring.send_msgs[slot];
+    sqe->len = 1;
+    sqe->user_data = (slot << 8) | URING_UD_SEND;
+    uring.last_send = sqe;
+
+    return sent_ns;
+}
+
+// Handle one completion. Without a pipeline (called from the send path)
+// receives are set aside for the next uring_reap().
+void uring_complete(pipeline_t *p, const struct io_uring_cqe *cqe) {
+    unsigned long long user_data = cqe->user_data;
+
+    switch (user_data & 0xFF) {
+        case URING_UD_RECV: {
+            if (!p) {
+                uring.deferred[uring.deferred_count++] = *cqe;
+                break;
+            }
+            if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                uring.recv_armed = false; // Re-armed on the next pass
+            }
+            if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+                break; // Error such as -ENOBUFS, no buffer consumed
+            }
+
+            unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            char *buf = uring.recv_buffers + (size_t)bid * uring.recv_buffer_size;
+            struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buf;
+            char *name = buf + sizeof(*out);
+            char *control = name + uring.recv_msg.msg_namelen;
+            char *payload = control + uring.recv_msg.msg_controllen;
+
+            if (cqe->res > 0 && !(out->flags & MSG_TRUNC)) {
+                long long kernel_rx_ns = 0;
+                if (kernel_timestamps) {
+                    struct msghdr msg = {0};
+                    msg.msg_control = control;
+                    msg.msg_controllen = out->controllen;
+                    kernel_rx_ns = rx_timestamp_ns(&msg);
+                }
+                struct sockaddr_in recv_addr;
+                memcpy(&recv_addr, name, sizeof(recv_addr));
+                process_pipelined_reply(p, payload, out->payloadlen, &recv_addr, kernel_rx_ns);
+            }
+            uring_provide_buffer(bid);
+            break;
+        }
+
+        case URING_UD_SEND:
+            uring.send_busy[(user_data >> 8) & 0xFFFFFF] = false;
+            if (cqe->res < 0) {
+                errno = -cqe->res;
+                perror("sendmsg failed");
+                break;
+            }
+            stats.send_count++;
+            break;
+
+        case URING_UD_TIMEOUT:
+            if ((long long)(user_data >> 8) == uring.timeout_armed_ns / 1000) {
+                uring.timeout_armed_ns = 0;
+            }
+            break;
+    }
+}
+
+// Process every completion that is ready, the set-aside receives first
+void uring_reap(pipeline_t *p) {
+    if (p) {
+        for (int i = 0; i < uring.deferred_count; i++) {
+            uring_complete(p, &uring.deferred[i]);
+        }
+        uring.deferred_count = 0;
+    }
+
+    unsigned head = *uring.cq_head;
+    unsigned tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        uring_complete(p, &uring.cqes[head & *uring.cq_mask]);
+    }
+    __atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Release everything uring_setup() created
+void uring_teardown() {
+    if (uring.sqes) munmap(uring.sqes, uring.sqes_size);
+    if (uring.cq_ring && uring.cq_ring != uring.sq_ring) munmap(uring.cq_ring, uring.cq_ring_size);
+    if (uring.sq_ring) munmap(uring.sq_ring, uring.sq_ring_size);
+    if (uring.buf_ring) munmap(uring.buf_ring, uring.buf_ring_size);
+    if (uring.fd >= 0) close(uring.fd);
+    free(uring.recv_buffers);
+    free(uring.send_buffers);
+    memset(&uring, 0, sizeof(uring));
+    uring.fd = -1;
+}
+
+// Create the ring and receive buffers; returns false if the kernel can't do
+// multishot recvmsg with provided buffers (io_uring missing, disabled, or < 6.0)
+bool uring_setup(int packet_size) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    uring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (uring.fd < 0) {
+        return false;
+    }
+
+    uring.sq_entries = params.sq_entries;
+    uring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring.cq_ring_size > uring.sq_ring_size) uring.sq_ring_size = uring.cq_ring_size;
+        uring.cq_ring_size = uring.sq_ring_size;
+    }
+
+    uring.sq_ring = mmap(NULL, uring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         uring.fd, IORING_OFF_SQ_RING);
+    if (uring.sq_ring == MAP_FAILED) {
+        uring.sq_ring = NULL;
+        goto fail;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        uring.cq_ring = uring.sq_ring;
+    } else {
+        uring.cq_ring = mmap(NULL, uring.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             uring.fd, IORING_OFF_CQ_RING);
+        if (uring.cq_ring == MAP_FAILED) {
+            uring.cq_ring = NULL;
+            goto fail;
+        }
+    }
+    uring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring.sqes = mmap(NULL, uring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      uring.fd, IORING_OFF_SQES);
+    if (uring.sqes == MAP_FAILED) {
+        uring.sqes = NULL;
+        goto fail;
+    }
+
+    char *sq = uring.sq_ring;
+    char *cq = uring.cq_ring;
+    uring.sq_head = (unsigned *)(sq + params.sq_off.head);
+    uring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    uring.sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    uring.sq_array = (unsigned *)(sq + params.sq_off.array);
+    uring.cq_head = (unsigned *)(cq + params.cq_off.head);
+    uring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    uring.cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    uring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    uring.sqe_tail = uring.submitted_tail = *uring.sq_tail;
+
+    // Receive buffers: recvmsg_out header, source address, control data, packet
+    uring.recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+    uring.recv_msg.msg_controllen = kernel_timestamps ? 128 : 0;
+    uring.recv_buffer_size = sizeof(struct io_uring_recvmsg_out) + uring.recv_msg.msg_namelen +
+                             uring.recv_msg.msg_controllen + packet_size + 60 + 8;
+    uring.recv_buffers = malloc((size_t)URING_BUFFERS * uring.recv_buffer_size);
+    uring.send_buffers = malloc((size_t)URING_SEND_BUFS * packet_size);
+    if (!uring.recv_buffers || !uring.send_buffers) {
+        goto fail;
+    }
+
+    for (int i = 0; i < URING_SEND_BUFS; i++) {
+        uring.send_iovs[i].iov_base = uring.send_buffers + (size_t)i * packet_size;
+        uring.send_msgs[i].msg_name = &dest_addr;
+        uring.send_msgs[i].msg_namelen = sizeof(dest_addr);
+        uring.send_msgs[i].msg_iov = &uring.send_iovs[i];
+        uring.send_msgs[i].msg_iovlen = 1;
+    }
+
+    // Register the provided-buffer ring (5.19+)
+    uring.buf_ring_size = URING_BUFFERS * sizeof(struct io_uring_buf);
+    uring.buf_ring = mmap(NULL, uring.buf_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (uring.buf_ring == MAP_FAILED) {
+        uring.buf_ring = NULL;
+        goto fail;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)uring.buf_ring;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = URING_BGID;
+    if (syscall(__NR_io_uring_register, uring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        goto fail;
+    }
+    for (int i = 0; i < URING_BUFFERS; i++) {
+        uring_provide_buffer(i);
+    }
+
+    // Multishot recvmsg (6.0+) fails straight away with -EINVAL where unsupported
+    uring_arm_recv();
+    if (uring_enter(0) < 0) {
+        goto fail;
+    }
+    unsigned head = *uring.cq_head;
+    if (head != __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &uring.cqes[head & *uring.cq_mask];
+        if (cqe->user_data == URING_UD_RECV && cqe->res == -EINVAL) {
+            goto fail;
+        }
+    }
+    return true;
+
+fail:
+    uring_teardown();
+    return false;
+}
+
+// Pipelined mode over io_uring; falls back to select() if the kernel lacks support
+void run_uring(char *packet, int packet_size, int count, int interval,
+               int timeout, int retries, int window, double pps) {
+    if (!uring_setup(packet_size)) {
+        log_message("io_uring unavailable, falling back to select()\n");
+        run_pipelined(packet, packet_size, count, interval, timeout, retries, window, pps);
+        return;
+    }
+
+    pipeline_t p;
+    if (!pipeline_init(&p, packet, packet_size, count, interval, timeout, retries, window)) {
+        uring_teardown();
+        return;
+    }
+    p.transmit = uring_send_probe;
+    if (pps > 0) {
+        pipeline_pace(&p, pps);
+    }
+
+    long long wake_ns;
+    while (!stop_ping && pipeline_service(&p, &wake_ns)) {
+        if (!uring.recv_armed) {
+            uring_arm_recv();
+        }
+        if (uring.timeout_armed_ns == 0 || wake_ns < uring.timeout_armed_ns) {
+            uring_arm_timeout(wake_ns);
+        }
+
+        // Submit sends and re-arms, then sleep until something completes
+        if (uring_enter(1) < 0) {
+            perror("io_uring_enter failed");
+            break;
+        }
+        drain_tx_timestamps(sockfd);
+        uring_reap(&p);
+    }
+
+    // Let queued sends finish before their buffers go away
+    while (1) {
+        bool busy = false;
+        for (int i = 0; i < URING_SEND_BUFS; i++) {
+            busy |= uring.send_busy[i];
+        }
+        if (!busy || uring_enter(1) < 0) {
+            break;
+        }
+        uring_reap(&p);
+    }
+
+    report_pacing(&p, pps, packet_size);
+    free(p.slots);
+    uring_teardown();
+}
+
+// Batched flood engine
+// -------------------------------------------------------------------
+// Sends probes `batch` at a time with one sendmmsg() and drains replies with
+// recvmmsg() into pre-allocated buffers, so the syscall cost is shared across
+// the whole batch. No per-probe retries: anything unanswered `timeout` seconds
+// after the last send counts as lost.
+
+// Match one received datagram against the packet history
+void process_batched_reply(char *recv_packet, int bytes_received, struct sockaddr_in *recv_addr,
+                           long long recv_ns, long long kernel_rx_ns) {
+    int icmp_len, ttl, seq;
+    struct icmphdr *icmp_header = parse_echo_reply(recv_packet, bytes_received, recv_addr,
+                                                   &icmp_len, &ttl, &seq);
+    if (!icmp_header) {
+        return;
+    }
+
+    packet_history_t *pkt = find_packet(seq);
+    if (!pkt || pkt->received) {
+        return; // Overwritten by a later generation, or a duplicate
+    }
+
+    double rtt = probe_rtt(seq, pkt->sent_ns, recv_ns, kernel_rx_ns);
+    record_reply(icmp_header, icmp_len, ttl, recv_addr, seq, rtt);
+}
+
+// Receive everything queued with recvmmsg(); returns the number of syscalls made
+int drain_batched_replies(struct mmsghdr *recv_msgs, struct sockaddr_in *recv_addrs, int batch) {
+    int syscalls = 0;
+
+    drain_tx_timestamps(sockfd);
+    while (1) {
+        // recvmmsg() updates the lengths in place, so reset them each round
+        for (int i = 0; i < batch; i++) {
+            recv_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            recv_msgs[i].msg_hdr.msg_controllen = kernel_timestamps ? 512 : 0;
+        }
+
+        int received = recvmmsg(sockfd, recv_msgs, batch, MSG_DONTWAIT, NULL);
+        syscalls++;
+        if (received <= 0) {
+            break;
+        }
+
+        long long recv_ns = monotonic_ns();
+        for (int i = 0; i < received; i++) {
+            struct msghdr *msg = &recv_msgs[i].msg_hdr;
+            long long kernel_rx_ns = kernel_timestamps ? rx_timestamp_ns(msg) : 0;
+            process_batched_reply(msg->msg_iov->iov_base, recv_msgs[i].msg_len, &recv_addrs[i],
+                                  recv_ns, kernel_rx_ns);
+        }
+
+        if (received < batch) {
+            break;
+        }
+    }
+
+    return syscalls;
+}
+
+// Receive everything that has arrived, from the ring or with recvmmsg(); returns
+// the number of syscalls made
+int drain_replies(rx_ring_t *ring, struct mmsghdr *recv_msgs, struct sockaddr_in *recv_addrs,
+                  int batch) {
+    if (ring->fd < 0) {
+        return drain_batched_replies(recv_msgs, recv_addrs, batch);
+    }
+    drain_tx_timestamps(sockfd);
+    rx_ring_drain(ring, process_batched_reply);
+    return 0;
+}
+
+// Flood the target in batches of `batch` probes, `interval` ms apart. With
+// use_ring, replies are read from a TPACKET_V3 ring instead of the raw socket.
+void run_batched(int packet_size, int count, int interval, int timeout, int batch, bool use_ring) {
+    int recv_size = packet_size + 60 + 8; // Room for IP options and ICMP error quotes
+    char *send_buffers = malloc((size_t)batch * packet_size);
+    char *recv_buffers = malloc((size_t)batch * recv_size);
+    char *recv_control = malloc((size_t)batch * 512);
+    struct mmsghdr *send_msgs = calloc(batch, sizeof(struct mmsghdr));
+    struct mmsghdr *recv_msgs = calloc(batch, sizeof(struct mmsghdr));
+    struct iovec *send_iovs = calloc(batch, sizeof(struct iovec));
+    struct iovec *recv_iovs = calloc(batch, sizeof(struct iovec));
+    struct sockaddr_in *recv_addrs = calloc(batch, sizeof(struct sockaddr_in));
+
+    if (!send_buffers || !recv_buffers || !recv_control || !send_msgs || !recv_msgs ||
+        !send_iovs || !recv_iovs || !recv_addrs) {
+        perror("Failed to allocate batch buffers");
+        goto cleanup;
+    }
+
+    for (int i = 0; i < batch; i++) {
+        send_iovs[i].iov_base = send_buffers + (size_t)i * packet_size;
+        send_iovs[i].iov_len = packet_size;
+        send_msgs[i].msg_hdr.msg_name = &dest_addr;
+        send_msgs[i].msg_hdr.msg_namelen = sizeof(dest_addr);
+        send_msgs[i].msg_hdr.msg_iov = &send_iovs[i];
+        send_msgs[i].msg_hdr.msg_iovlen = 1;
+
+        recv_iovs[i].iov_base = recv_buffers + (size_t)i * recv_size;
+        recv_iovs[i].iov_len = recv_size;
+        recv_msgs[i].msg_hdr.msg_name = &recv_addrs[i];
+        recv_msgs[i].msg_hdr.msg_iov = &recv_iovs[i];
+        recv_msgs[i].msg_hdr.msg_iovlen = 1;
+        recv_msgs[i].msg_hdr.msg_control = recv_control + (size_t)i * 512;
+    }
+
+    // Build every slot's packet once, each send only restamps it
+    for (int i = 0; i < batch; i++) {
+        prepare_icmp_packet((struct icmphdr *)send_iovs[i].iov_base, i, packet_size);
+    }
+
+    // The raw socket only sends once the ring takes over receiving
+    rx_ring_t ring = { .fd = -1 };
+    if (use_ring) {
+        if (!rx_ring_setup(&ring)) {
+            fprintf(stderr, "Packet ring unavailable, receiving with recvmmsg().\n");
+        } else if (!attach_drop_filter(sockfd)) {
+            perror("setsockopt SO_ATTACH_FILTER failed");
+        }
+    }
+    int recv_fd = ring.fd >= 0 ? ring.fd : sockfd;
+
+    long long syscalls = 0;
+    long long start_ns = monotonic_ns();
+    int seq_num = 0;
+
+    while (!stop_ping && (count == -1 || stats.original_send_count < count)) {
+        int n = batch;
+        if (count != -1 && count - stats.original_send_count < n) {
+            n = count - stats.original_send_count;
+        }
+
+        // Build the whole batch, then hand it to the kernel in one call
+        for (int i = 0; i < n; i++) {
+            restamp_icmp_packet((struct icmphdr *)send_iovs[i].iov_base, seq_num + i, packet_size);
+            add_packet_to_history(seq_num + i);
+        }
+
+        long long sent_ns = monotonic_ns();
+        int sent = 0;
+        while (sent < n) {
+            int r = sendmmsg(sockfd, send_msgs + sent, n - sent, 0);
+            syscalls++;
+            if (r < 0) {
+                perror("sendmmsg failed");
+                break;
+            }
+            for (int i = sent; i < sent + r; i++) {
+                packet_history_t *pkt = find_packet(seq_num + i);
+                pkt->sent_ns = sent_ns;
+                if (kernel_timestamps) {
+                    pkt->tx_ns = realtime_ns();
+                }
+                if (kernel_tx_timestamps) {
+                    tx_id_seq[tx_id_next & (HISTORY_SIZE - 1)] = seq_num + i;
+                    tx_id_next++;
+                }
+            }
+            sent += r;
+        }
+
+        stats.send_count += sent;
+        stats.original_send_count += n;
+        seq_num += n;
+
+        syscalls += drain_replies(&ring, recv_msgs, recv_addrs, batch);
+
+        if (interval > 0) {
+            usleep(interval * 1000);
+        }
+    }
+
+    // Collect the stragglers
+    long long deadline_us = current_timestamp_us() + (long long)timeout * 1000000;
+    while (!stop_ping && stats.recv_count < stats.send_count) {
+        long long wait_us = deadline_us - current_timestamp_us();
+        if (wait_us <= 0) {
+            break;
+        }
+
+        struct timeval wait_time = { wait_us / 1000000, wait_us % 1000000 };
+        fd_set read_set;
+        FD_ZERO(&read_set);
+        FD_SET(recv_fd, &read_set);
+        int ready = select(recv_fd + 1, &read_set, NULL, NULL, &wait_time);
+        syscalls++;
+        if (ready <= 0) {
+            break;
+        }
+        syscalls += drain_replies(&ring, recv_msgs, recv_addrs, batch);
+    }
+
+    double elapsed = (monotonic_ns() - start_ns) / 1000000000.0;
+    log_message("Batch: %d sent, %d received in %.3f s (%.0f pps sent, %.0f pps received), "
+                "%.3f syscalls/packet\n",
+                stats.send_count, stats.recv_count, elapsed,
+                elapsed > 0 ? stats.send_count / elapsed : 0,
+                elapsed > 0 ? stats.recv_count / elapsed : 0,
+                stats.send_count + stats.recv_count > 0 ? (double)syscalls / (stats.send_count + stats.recv_count) : 0);
+    rx_ring_teardown(&ring);
+
+cleanup:
+    free(send_buffers);
+    free(recv_buffers);
+    free(recv_control);
+    free(send_msgs);
+    free(recv_msgs);
+    free(send_iovs);
+    free(recv_iovs);
+    free(recv_addrs);
+}
+
+// Multi-core flood engine
+// -------------------------------------------------------------------
+// Spreads a flood across worker threads pinned to separate CPUs. Each worker
+// has its own raw socket, ICMP identifier (ident + worker number) and sequence
+// space, and sends and drains in batches like -B. Workers never touch shared
+// state: each keeps its counters and RTT histogram in its own stats shard, and
+// the main thread reads the shards through a seqlock for its periodic reports
+// and merges them for the final statistics.
+
+// A corrupt reply seen by a flood worker, waiting for the main thread to log it
+typedef struct {
+    int icmp_len;
+    int seq_num;
+    int ttl;
+    double rtt;
+    bool checksum_valid;
+    bool data_valid;
+} flood_corrupt_t;
+
+// One flood worker thread
+typedef struct {
+    pthread_t thread;
+    int index;                // Worker number
+    int cpu;                  // CPU the thread is pinned to (-1 = unpinned)
+    int sock;                 // Private raw socket
+    unsigned short ident;     // Private ICMP identifier
+    int count;                // Probes this worker sends (-1 = infinite)
+    int packet_size;
+    int interval;             // Gap between batches (ms)
+    int timeout;              // Straggler wait after the last batch (seconds)
+    int batch;                // Probes per sendmmsg()
+    int done;                 // Set by the worker when it has finished
+    int *sent_seq;            // Sequence number sent into each ring slot (-1 = answered)
+    long long *sent_ns;       // Send time of each ring slot (CLOCK_MONOTONIC)
+    stats_shard_t shard;
+    // Corrupt replies for the main thread to log: workers never touch the
+    // logger's ring, which has a single producer
+    flood_corrupt_t *corrupt; // FLOOD_LOG_EVENTS slots
+    unsigned corrupt_head __attribute__((aligned(64)));  // Next slot to fill (worker)
+    unsigned corrupt_tail __attribute__((aligned(64)));  // Next slot to log (main thread)
+    unsigned long long corrupt_unlogged;  // Lost to a full queue
+} __attribute__((aligned(64))) flood_worker_t;
+
+// Queue a corrupt reply for the main thread to log; dropped if it is behind
+void queue_flood_corrupt(flood_worker_t *w, const flood_corrupt_t *c) {
+    unsigned head = w->corrupt_head;
+    if (head - __atomic_load_n(&w->corrupt_tail, __ATOMIC_ACQUIRE) >= FLOOD_LOG_EVENTS) {
+        __atomic_store_n(&w->corrupt_unlogged, w->corrupt_unlogged + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    w->corrupt[head & (FLOOD_LOG_EVENTS - 1)] = *c;
+    __atomic_store_n(&w->corrupt_head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Log the corrupt replies the workers have queued (main thread)
+void log_flood_corrupt(flood_worker_t *workers, int worker_count) {
+    for (int i = 0; i < worker_count; i++) {
+        flood_worker_t *w = &workers[i];
+        unsigned head = __atomic_load_n(&w->corrupt_head, __ATOMIC_ACQUIRE);
+        for (unsigned tail = w->corrupt_tail; tail != head; tail++) {
+            const flood_corrupt_t *c = &w->corrupt[tail & (FLOOD_LOG_EVENTS - 1)];
+            log_reply(c->icmp_len, &dest_addr, c->seq_num, c->ttl, c->rtt, true,
+                      c->checksum_valid, c->data_valid);
+            __atomic_store_n(&w->corrupt_tail, tail + 1, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+// Match one datagram against this worker's outstanding probes
+void process_flood_reply(flood_worker_t *w, int next_seq, char *recv_packet, int bytes_received,
+                         struct sockaddr_in *recv_addr, long long recv_ns) {
+    int icmp_len, ttl;
+    struct icmphdr *icmp_header = parse_icmp_packet(recv_packet, bytes_received, &icmp_len, &ttl);
+    if (!icmp_header || icmp_header->type != ICMP_ECHOREPLY ||
+        icmp_header->un.echo.id != w->ident ||
+        recv_addr->sin_addr.s_addr != dest_addr.sin_addr.s_addr) {
+        return; // Other workers' and other processes' traffic
+    }
+
+    int last_seq = next_seq - 1;
+    int seq = last_seq - (unsigned short)(last_seq - icmp_header->un.echo.sequence);
+    int slot = seq & (HISTORY_SIZE - 1);
+    if (seq < 0 || w->sent_seq[slot] != seq) {
+        return; // Duplicate, or too old to still be tracked
+    }
+    w->sent_seq[slot] = -1;
+
+    double rtt = (recv_ns - w->sent_ns[slot]) / 1000000.0;
+    bool checksum_valid, data_valid;
+    bool is_corrupted = reply_corrupted(icmp_header, icmp_len, &checksum_valid, &data_valid);
+
+    w->shard.stats.recv_count++;
+    if (is_corrupted) {
+        w->shard.stats.corrupt_count++;
+        if (log_wanted(LOG_REPLIES)) {
+            flood_corrupt_t c = { icmp_len, seq, ttl, rtt, checksum_valid, data_valid };
+            queue_flood_corrupt(w, &c);
+        }
+    } else {
+        hist_record(&w->shard.stats.rtt, rtt);
+    }
+}
+
+// Receive everything queued on the worker's socket
+void drain_flood_replies(flood_worker_t *w, int next_seq, struct mmsghdr *recv_msgs,
+                         struct sockaddr_in *recv_addrs) {
+    while (1) {
+        for (int i = 0; i < w->batch; i++) {
+            recv_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        }
+        int received = recvmmsg(w->sock, recv_msgs, w->batch, MSG_DONTWAIT, NULL);
+        if (received <= 0) {
+            break;
+        }
+
+        long long recv_ns = monotonic_ns();
+        shard_write_begin(&w->shard);
+        for (int i = 0; i < received; i++) {
+            process_flood_reply(w, next_seq, recv_msgs[i].msg_hdr.msg_iov->iov_base,
+                                recv_msgs[i].msg_len, &recv_addrs[i], recv_ns);
+        }
+        shard_write_end(&w->shard);
+
+        if (received < w->batch) {
+            break;
+        }
+    }
+}
+
+void *flood_worker_main(void *arg) {
+    flood_worker_t *w = arg;
+
+    if (w->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    int recv_size = w->packet_size + 60 + 8;
+    char *send_buffers = malloc((size_t)w->batch * w->packet_size);
+    char *recv_buffers = malloc((size_t)w->batch * recv_size);
+    struct mmsghdr *send_msgs = calloc(w->batch, sizeof(struct mmsghdr));
+    struct mmsghdr *recv_msgs = calloc(w->batch, sizeof(struct mmsghdr));
+    struct iovec *send_iovs = calloc(w->batch, sizeof(struct iovec));
+    struct iovec *recv_iovs = calloc(w->batch, sizeof(struct iovec));
+    struct sockaddr_in *recv_addrs = calloc(w->batch, sizeof(struct sockaddr_in));
+    if (!send_buffers || !recv_buffers || !send_msgs || !recv_msgs ||
+        !send_iovs || !recv_iovs || !recv_addrs) {
+        perror("Failed to allocate flood buffers");
+        goto cleanup;
+    }
+
+    for (int i = 0; i < w->batch; i++) {
+        send_iovs[i].iov_base = send_buffers + (size_t)i * w->packet_size;
+        send_iovs[i].iov_len = w->packet_size;
+        send_msgs[i].msg_hdr.msg_name = &dest_addr;
+        send_msgs[i].msg_hdr.msg_namelen = sizeof(dest_addr);
+        send_msgs[i].msg_hdr.msg_iov = &send_iovs[i];
+        send_msgs[i].msg_hdr.msg_iovlen = 1;
+
+        recv_iovs[i].iov_base = recv_buffers + (size_t)i * recv_size;
+        recv_iovs[i].iov_len = recv_size;
+        recv_msgs[i].msg_hdr.msg_name = &recv_addrs[i];
+        recv_msgs[i].msg_hdr.msg_iov = &recv_iovs[i];
+        recv_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // Build every slot's packet once, each send only restamps it
+    for (int i = 0; i < w->batch; i++) {
+        prepare_icmp_packet_id((struct icmphdr *)send_iovs[i].iov_base, w->ident, i, w->packet_size);
+    }
+
+    int seq_num = 0;
+    int sent_total = 0;
+    while (!stop_ping && (w->count == -1 || sent_total < w->count)) {
+        int n = w->batch;
+        if (w->count != -1 && w->count - sent_total < n) {
+            n = w->count - sent_total;
+        }
+
+        for (int i = 0; i < n; i++) {
+            restamp_icmp_packet((struct icmphdr *)send_iovs[i].iov_base, seq_num + i, w->packet_size);
+        }
+
+        long long sent_ns = monotonic_ns();
+        int sent = 0;
+        while (sent < n) {
+            int r = sendmmsg(w->sock, send_msgs + sent, n - sent, 0);
+            if (r < 0) {
+                perror("sendmmsg failed");
+                break;
+            }
+            sent += r;
+        }
+        for (int i = 0; i < n; i++) {
+            int slot = (seq_num + i) & (HISTORY_SIZE - 1);
+            w->sent_seq[slot] = seq_num + i;
+            w->sent_ns[slot] = sent_ns;
+        }
+
+        shard_write_begin(&w->shard);
+        w->shard.stats.send_count += sent;
+        w->shard.stats.original_send_count += n;
+        shard_write_end(&w->shard);
+
+        seq_num += n;
+        sent_total += n;
+        drain_flood_replies(w, seq_num, recv_msgs, recv_addrs);
+
+        if (w->interval > 0) {
+            usleep(w->interval * 1000);
+        }
+    }
+
+    // Collect the stragglers
+    long long deadline_us = current_timestamp_us() + (long long)w->timeout * 1000000;
+    while (!stop_ping) {
+        ping_stats_t *st = &w->shard.stats;
+        long long wait_us = deadline_us - current_timestamp_us();
+        if (st->recv_count >= st->send_count || wait_us <= 0) {
+            break;
+        }
+        struct timeval wait_time = { wait_us / 1000000, wait_us % 1000000 };
+        fd_set read_set;
+        FD_ZERO(&read_set);
+        FD_SET(w->sock, &read_set);
+        if (select(w->sock + 1, &read_set, NULL, NULL, &wait_time) <= 0) {
+            break;
+        }
+        drain_flood_replies(w, seq_num, recv_msgs, recv_addrs);
+    }
+
+cleanup:
+    free(send_buffers);
+    free(recv_buffers);
+    free(send_msgs);
+    free(recv_msgs);
+    free(send_iovs);
+    free(recv_iovs);
+    free(recv_addrs);
+    __atomic_store_n(&w->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Open and configure a worker's private raw socket
+int open_flood_socket(int ttl, unsigned short id) {
+    int sock = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+    if (sock < 0) {
+        return -1;
+    }
+    int rcvbufsize = 4 * 1024 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbufsize, sizeof(rcvbufsize));
+    if (setsockopt(sock, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) < 0) {
+        close(sock);
+        return -1;
+    }
+    // Without the filter every worker would also receive its siblings' replies
+    if (!attach_reply_filter(sock, id, &dest_addr.sin_addr.s_addr, 1)) {
+        perror("setsockopt SO_ATTACH_FILTER failed");
+    }
+    return sock;
+}
+
+// Sum every worker's shard into one snapshot
+void snapshot_flood_stats(flood_worker_t *workers, int worker_count, ping_stats_t *total) {
+    static ping_stats_t snapshot; // Large (histogram), keep it off the stack
+    memset(total, 0, sizeof(*total));
+    for (int i = 0; i < worker_count; i++) {
+        shard_snapshot(&workers[i].shard, &snapshot);
+        stats_merge(total, &snapshot);
+    }
+}
+
+// Flood the target from `worker_count` pinned threads, reporting once a second
+void run_flood(int packet_size, int count, int interval, int timeout, int batch,
+               int ttl, int worker_count) {
+    flood_worker_t *workers = aligned_alloc(64, sizeof(flood_worker_t) * worker_count);
+    if (!workers) {
+        perror("Failed to allocate flood workers");
+        return;
+    }
+    memset(workers, 0, sizeof(flood_worker_t) * worker_count);
+
+    // Pin workers round-robin over the CPUs we are allowed to run on
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE];
+    int cpu_count = 0;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) cpus[cpu_count++] = cpu;
+        }
+    }
+
+    int started = 0;
+    for (int i = 0; i < worker_count; i++) {
+        flood_worker_t *w = &workers[i];
+        w->index = i;
+        w->cpu = cpu_count > 0 ? cpus[i % cpu_count] : -1;
+        w->ident = (unsigned short)(ident + i);
+        w->count = count == -1 ? -1 : count / worker_count + (i < count % worker_count);
+        w->packet_size = packet_size;
+        w->interval = interval;
+        w->timeout = timeout;
+        w->batch = batch;
+        w->sent_seq = malloc(HISTORY_SIZE * sizeof(int));
+        w->sent_ns = malloc(HISTORY_SIZE * sizeof(long long));
+        w->corrupt = malloc(FLOOD_LOG_EVENTS * sizeof(flood_corrupt_t));
+        w->sock = open_flood_socket(ttl, w->ident);
+        if (w->sock < 0 || !w->sent_seq || !w->sent_ns || !w->corrupt) {
+            perror("Failed to set up flood worker");
+            break;
+        }
+        memset(w->sent_seq, 0xFF, HISTORY_SIZE * sizeof(int));
+
+        if (start_thread(&w->thread, flood_worker_main, w) != 0) {
+            perror("pthread_create failed");
+            break;
+        }
+        started++;
+    }
+
+    log_message("Flood: %d workers, batch %d\n", started, batch);
+
+    // Periodic reports until every worker has finished
+    long long start_ns = monotonic_ns();
+    ping_stats_t *total = malloc(sizeof(ping_stats_t));
+    int last_sent = 0, last_recv = 0;
+    while (total) {
+        // Sleep in short slices so a finished run is noticed promptly
+        bool running = true;
+        for (int tick = 0; tick < 10 && running; tick++) {
+            usleep(100000);
+            log_flood_corrupt(workers, started);
+            running = false;
+            for (int i = 0; i < started; i++) {
+                if (!__atomic_load_n(&workers[i].done, __ATOMIC_ACQUIRE)) running = true;
+            }
+        }
+        if (!running) {
+            break;
+        }
+
+        snapshot_flood_stats(workers, started, total);
+        if (metrics_enabled) {
+            metrics_publish(total);
+        }
+        log_verbose(LOG_EVENTS, "[%.1fs] sent %d (%d pps), received %d (%d pps), corrupted %d, RTT p50/p99 = %.3f/%.3f ms\n",
+                    (monotonic_ns() - start_ns) / 1000000000.0,
+                    total->send_count, total->send_count - last_sent,
+                    total->recv_count, total->recv_count - last_recv,
+                    total->corrupt_count,
+                    hist_percentile(&total->rtt, 0.50), hist_percentile(&total->rtt, 0.99));
+        last_sent = total->send_count;
+        last_recv = total->recv_count;
+    }
+    free(total);
+
+    // Workers are done; log what they left queued and fold their shards into the run totals
+    unsigned long long unlogged = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    log_flood_corrupt(workers, started);
+    for (int i = 0; i < worker_count; i++) {
+        stats_merge(&stats, &workers[i].shard.stats);
+        unlogged += workers[i].corrupt_unlogged;
+        if (workers[i].sock > 0) close(workers[i].sock);
+        free(workers[i].sent_seq);
+        free(workers[i].sent_ns);
+        free(workers[i].corrupt);
+    }
+    if (unlogged > 0) {
+        log_message("Flood: %llu corrupt replies not logged (workers' queues full)\n", unlogged);
+    }
+
+    double elapsed = (monotonic_ns() - start_ns) / 1000000000.0;
+    log_message("Flood: %d sent, %d received in %.3f s (%.0f pps sent, %.0f pps received)\n",
+                stats.send_count, stats.recv_count, elapsed,
+                elapsed > 0 ? stats.send_count / elapsed : 0,
+                elapsed > 0 ? stats.recv_count / elapsed : 0);
+    free(workers);
+}
+
+// Multi-target engine
+// -------------------------------------------------------------------
+// Probes many hosts from one raw socket. Each target runs its own
+// stop-and-wait schedule (one probe in flight, same timeout and retry rules as
+// the single-target loop) and keeps its own statistics. Replies are matched to
+// a target by source address (ICMP errors by the destination they quote) and
+// then by sequence number. Targets wait in a min-heap ordered by their next
+// event, and the loop sleeps in epoll_wait() on the socket plus a timerfd armed
+// for the earliest one.
+
+// Per-target state and results
+typedef struct {
+    char name[256];             // Host as given
+    char ip[INET_ADDRSTRLEN];   // Resolved address
+    struct sockaddr_in addr;
+    int interval;               // Gap between new probes to this target (ms)
+    int seq_num;                // Sequence number of the latest probe
+    bool in_flight;             // Latest probe not yet answered or given up on
+    bool awaiting_retry;        // Timed out, waiting RETRY_INTERVAL before resend
+    int tries;                  // Transmissions of the latest probe
+    long long sent_ns;          // Latest transmission (CLOCK_MONOTONIC)
+    long long next_send_us;     // When the next new probe is due
+    long long deadline_us;      // Timeout or retry time of the in-flight probe
+    long long wake_us;          // Heap key: next time this target needs service
+    int heap_index;             // Position in the event heap (-1 once finished)
+    ping_stats_t stats;
+} target_t;
+
+// Targets, their event heap and the source address lookup table
+typedef struct {
+    target_t *targets;
+    int count;
+    target_t **heap;            // Min-heap on wake_us
+    int heap_size;
+    int *addr_table;            // Open addressing on s_addr, holds index + 1
+    unsigned addr_mask;
+} target_set_t;
+
+// Heap helpers
+void target_heap_swap(target_set_t *set, int a, int b) {
+    target_t *tmp = set->heap[a];
+    set->heap[a] = set->heap[b];
+    set->heap[b] = tmp;
+    set->heap[a]->heap_index = a;
+    set->heap[b]->heap_index = b;
+}
+
+void target_heap_sift(target_set_t *set, int i) {
+    while (i > 0 && set->heap[i]->wake_us < set->heap[(i - 1) / 2]->wake_us) {
+        target_heap_swap(set, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    while (1) {
+        int smallest = i;
+        int left = 2 * i + 1, right = 2 * i + 2;
+        if (left < set->heap_size && set->heap[left]->wake_us < set->heap[smallest]->wake_us) smallest = left;
+        if (right < set->heap_size && set->heap[right]->wake_us < set->heap[smallest]->wake_us) smallest = right;
+        if (smallest == i) break;
+        target_heap_swap(set, i, smallest);
+        i = smallest;
+    }
+}
+
+void target_heap_remove(target_set_t *set, target_t *t) {
+    int i = t->heap_index;
+    set->heap_size--;
+    if (i != set->heap_size) {
+        target_heap_swap(set, i, set->heap_size);
+        target_heap_sift(set, i);
+    }
+    t->heap_index = -1;
+}
+
+// Find the target with this address (NULL if it isn't one of ours)
+target_t *target_lookup(target_set_t *set, in_addr_t s_addr) {
+    for (unsigned h = (s_addr * 2654435761u) & set->addr_mask; set->addr_table[h]; h = (h + 1) & set->addr_mask) {
+        target_t *t = &set->targets[set->addr_table[h] - 1];
+        if (t->addr.sin_addr.s_addr == s_addr) {
+            return t;
+        }
+    }
+    return NULL;
+}
+
+// Resolve and register targets; duplicates and unresolvable hosts are skipped
+bool target_set_init(target_set_t *set, char **hosts, int *intervals, int host_count) {
+    memset(set, 0, sizeof(*set));
+    unsigned table_size = 16;
+    while (table_size < (unsigned)host_count * 2) table_size <<= 1;
+
+    set->targets = calloc(host_count, sizeof(target_t));
+    set->heap = calloc(host_count, sizeof(target_t *));
+    set->addr_table = calloc(table_size, sizeof(int));
+    set->addr_mask = table_size - 1;
+    if (!set->targets || !set->heap || !set->addr_table) {
+        perror("Failed to allocate targets");
+        return false;
+    }
+
+    for (int i = 0; i < host_count; i++) {
+        struct hostent *host_entity = gethostbyname(hosts[i]);
+        if (!host_entity) {
+            fprintf(stderr, "Cannot resolve %s, skipping\n", hosts[i]);
+            continue;
+        }
+        in_addr_t s_addr = ((struct in_addr *)host_entity->h_addr)->s_addr;
+        if (target_lookup(set, s_addr)) {
+            fprintf(stderr, "Duplicate target %s, skipping\n", hosts[i]);
+            continue;
+        }
+
+        target_t *t = &set->targets[set->count];
+        snprintf(t->name, sizeof(t->name), "%s", hosts[i]);
+        t->addr.sin_family = AF_INET;
+        t->addr.sin_addr.s_addr = s_addr;
+        inet_ntop(AF_INET, &t->addr.sin_addr, t->ip, sizeof(t->ip));
+        t->interval = intervals[i];
+        t->seq_num = -1;
+
+        unsigned h = (s_addr * 2654435761u) & set->addr_mask;
+        while (set->addr_table[h]) h = (h + 1) & set->addr_mask;
+        set->addr_table[h] = set->count + 1;
+        set->count++;
+    }
+    return set->count > 0;
+}
+
+void target_set_free(target_set_t *set) {
+    free(set->targets);
+    free(set->heap);
+    free(set->addr_table);
+}
+
+// Send the target's current probe (first transmission or retry)
+void send_target_probe(target_t *t, char *packet, int packet_size, int timeout) {
+    restamp_icmp_packet((struct icmphdr *)packet, t->seq_num, packet_size);
+    t->sent_ns = monotonic_ns();
+
+    if (sendto(sockfd, packet, packet_size, 0, (struct sockaddr *)&t->addr, sizeof(t->addr)) < 0) {
+        perror("sendto failed");
+    } else {
+        t->stats.send_count++;
+    }
+
+    t->tries++;
+    t->awaiting_retry = false;
+    t->deadline_us = current_timestamp_us() + (long long)timeout * 1000000;
+}
+
+// Handle a target whose wake time has come; returns false once it is finished
+bool service_target(target_t *t, char *packet, int packet_size, int count, int timeout, int retries) {
+    long long now_us = current_timestamp_us();
+
+    if (t->in_flight && now_us >= t->deadline_us) {
+        if (t->awaiting_retry) {
+            t->stats.resend_count++;
+            log_verbose(LOG_EVENTS, "Retrying %s seq=%d (attempt %d/%d)\n", t->ip, t->seq_num, t->tries, retries);
+            send_target_probe(t, packet, packet_size, timeout);
+        } else {
+            log_verbose(LOG_EVENTS, "Request timeout for %s icmp_seq=%d (try %d/%d)\n",
+                        t->ip, t->seq_num, t->tries, retries + 1);
+            if (t->tries > retries) {
+                t->in_flight = false;
+            } else {
+                t->awaiting_retry = true;
+                t->deadline_us = now_us + RETRY_INTERVAL * 1000;
+            }
+        }
+    }
+
+    bool more_to_send = count == -1 || t->stats.original_send_count < count;
+    if (!t->in_flight && more_to_send && now_us >= t->next_send_us) {
+        t->seq_num++;
+        t->tries = 0;
+        t->in_flight = true;
+        t->stats.original_send_count++;
+        send_target_probe(t, packet, packet_size, timeout);
+
+        // Stay on the target's schedule, but don't burst to catch up after a stall
+        t->next_send_us += (long long)t->interval * 1000;
+        if (t->next_send_us < now_us) {
+            t->next_send_us = now_us;
+        }
+        more_to_send = count == -1 || t->stats.original_send_count < count;
+    }
+
+    if (t->in_flight) {
+        t->wake_us = t->deadline_us;
+        return true;
+    }
+    t->wake_us = t->next_send_us;
+    return more_to_send;
+}
+
+// Match one datagram to a target; returns the target it completed, if any
+target_t *process_target_reply(target_set_t *set, char *recv_packet, int bytes_received,
+                               struct sockaddr_in *recv_addr) {
+    long long recv_ns = monotonic_ns();
+
+    int icmp_len, ttl;
+    struct icmphdr *icmp_header = parse_icmp_packet(recv_packet, bytes_received, &icmp_len, &ttl);
+    if (!icmp_header) {
+        return NULL;
+    }
+
+    // ICMP errors are attributed to the target the quoted probe was sent to
+    struct iphdr *inner_ip;
+    struct icmphdr *inner_icmp = quoted_probe(icmp_header, icmp_len, &inner_ip);
+    if (inner_icmp) {
+        target_t *t = target_lookup(set, inner_ip->daddr);
+        if (t && icmp_header->type == ICMP_DEST_UNREACH) {
+            log_verbose(LOG_EVENTS, "From %s: Destination unreachable (code=%d) for %s icmp_seq=%d\n",
+                        inet_ntoa(recv_addr->sin_addr), icmp_header->code, t->ip,
+                        inner_icmp->un.echo.sequence);
+        } else if (t) {
+            log_verbose(LOG_EVENTS, "From %s: Time to live exceeded for %s icmp_seq=%d\n",
+                        inet_ntoa(recv_addr->sin_addr), t->ip, inner_icmp->un.echo.sequence);
+        }
+        return NULL;
+    }
+
+    if (icmp_header->type != ICMP_ECHOREPLY || icmp_header->un.echo.id != ident) {
+        return NULL;
+    }
+
+    target_t *t = target_lookup(set, recv_addr->sin_addr.s_addr);
+    if (!t || !t->in_flight || icmp_header->un.echo.sequence != (t->seq_num & 0xFFFF)) {
+        return NULL; // Not ours, late, or a duplicate
+    }
+
+    double rtt = (recv_ns - t->sent_ns) / 1000000.0;
+    t->in_flight = false;
+    t->stats.recv_count++;
+    if (t->tries > 1) {
+        t->stats.rereceived_count++;
+    }
+
+    bool checksum_valid, data_valid;
+    bool is_corrupted = reply_corrupted(icmp_header, icmp_len, &checksum_valid, &data_valid);
+    if (is_corrupted) {
+        t->stats.corrupt_count++;
+    } else {
+        hist_record(&t->stats.rtt, rtt);
+    }
+
+    log_reply(icmp_len, recv_addr, t->seq_num, ttl, rtt, is_corrupted, checksum_valid, data_valid);
+    return t;
+}
+
+// Probe every target on its own schedule until each has sent `count` probes
+void run_multi_target(target_set_t *set, char *packet, int packet_size, int count,
+                      int timeout, int retries) {
+    int epfd = epoll_create1(0);
+    int tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+    if (epfd < 0 || tfd < 0) {
+        perror("epoll/timerfd setup failed");
+        if (epfd >= 0) close(epfd);
+        if (tfd >= 0) close(tfd);
+        return;
+    }
+
+    // All targets share one packet, restamped for each send
+    prepare_icmp_packet((struct icmphdr *)packet, 0, packet_size);
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = sockfd };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev);
+    ev.data.fd = tfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+
+    // Spread first probes across each target's interval to avoid a burst
+    long long start_us = current_timestamp_us();
+    for (int i = 0; i < set->count; i++) {
+        target_t *t = &set->targets[i];
+        t->next_send_us = start_us + (long long)t->interval * 1000 * i / set->count;
+        t->wake_us = t->next_send_us;
+        t->heap_index = set->heap_size;
+        set->heap[set->heap_size++] = t;
+        target_heap_sift(set, t->heap_index);
+    }
+
+    char recv_packet[MAX_PACKET_SIZE];
+    struct epoll_event events[2];
+    ping_stats_t *metrics_scratch = metrics_enabled ? malloc(sizeof(ping_stats_t)) : NULL;
+
+    while (!stop_ping && set->heap_size > 0) {
+        // Service every target that is due
+        long long now_us = current_timestamp_us();
+        while (set->heap_size > 0 && set->heap[0]->wake_us <= now_us) {
+            target_t *t = set->heap[0];
+            if (service_target(t, packet, packet_size, count, timeout, retries)) {
+                target_heap_sift(set, 0);
+            } else {
+                target_heap_remove(set, t);
+            }
+        }
+        if (set->heap_size == 0) {
+            break;
+        }
+        if (metrics_scratch && metrics_due(now_us * 1000)) {
+            memset(metrics_scratch, 0, sizeof(*metrics_scratch));
+            for (int i = 0; i < set->count; i++) {
+                stats_merge(metrics_scratch, &set->targets[i].stats);
+            }
+            metrics_publish(metrics_scratch);
+        }
+
+        // Sleep until the earliest target is due or a reply arrives
+        long long wake_us = set->heap[0]->wake_us;
+        struct itimerspec its = {0};
+        its.it_value.tv_sec = wake_us / 1000000;
+        its.it_value.tv_nsec = (wake_us % 1000000) * 1000;
+        timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+
+        int n = epoll_wait(epfd, events, 2, -1);
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == tfd) {
+                uint64_t expirations;
+                if (read(tfd, &expirations, sizeof(expirations)) < 0) {
+                    // Already consumed, nothing to do
+                }
+                continue;
+            }
+
+            // Drain until empty; with -d this also empties the error queue, which
+            // otherwise keeps the socket readable for epoll
+            while (1) {
+                struct sockaddr_in recv_addr;
+                long long kernel_rx_ns;
+                int bytes_received = receive_datagram(sockfd, recv_packet, sizeof(recv_packet), MSG_DONTWAIT,
+                                                      &recv_addr, &kernel_rx_ns);
+                if (bytes_received <= 0) {
+                    break;
+                }
+
+                // A finished probe makes the target due for its next send
+                target_t *t = process_target_reply(set, recv_packet, bytes_received, &recv_addr);
+                if (t && t->heap_index >= 0) {
+                    t->wake_us = t->next_send_us;
+                    target_heap_sift(set, t->heap_index);
+                }
+            }
+        }
+    }
+
+    free(metrics_scratch);
+    close(tfd);
+    close(epfd);
+}
+
+// Read a target list: one host per line, optionally followed by its interval in
+// ms; blank lines and '#' comments are ignored
+int read_target_file(const char *path, char ***hosts, int **intervals, int *host_count,
+                     int *capacity, int default_interval) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror("Failed to open target file");
+        return -1;
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+
+        char host[256];
+        int interval = default_interval;
+        if (sscanf(line, "%255s %d", host, &interval) < 1) {
+            continue;
+        }
+
+        if (*host_count == *capacity) {
+            *capacity = *capacity ? *capacity * 2 : 64;
+            *hosts = realloc(*hosts, *capacity * sizeof(char *));
+            *intervals = realloc(*intervals, *capacity * sizeof(int));
+            if (!*hosts || !*intervals) {
+                perror("Failed to allocate target list");
+                fclose(f);
+                return -1;
+            }
+        }
+        (*hosts)[*host_count] = strdup(host);
+        (*intervals)[*host_count] = interval;
+        (*host_count)++;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+// Metrics exporter
+// -------------------------------------------------------------------
+// -M serves the live run statistics over HTTP in the OpenMetrics text format,
+// for Prometheus-style scraping. The exporter thread never touches engine
+// state: it copies the latest snapshot out of metrics_shard, which the engines
+// republish at most every METRICS_PUBLISH_NS. A scrape therefore costs the
+// send/receive path nothing.
+
+// Upper bounds (seconds) of the exported RTT histogram buckets
+static const double metrics_rtt_bounds[] = {
+    0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+    0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+
+char metrics_target[64];      // Labels for enhanced_ping_run_info
+int metrics_packet_size;
+
+// Render a snapshot as an OpenMetrics exposition; returns its length
+int format_metrics(const ping_stats_t *st, char *buf, int size) {
+    int len = 0;
+    #define APPEND(...) do { if (len < size) len += snprintf(buf + len, size - len, __VA_ARGS__); } while (0)
+    #define COUNTER(name, help, value) \
+        APPEND("# TYPE enhanced_ping_" name " counter\n# HELP enhanced_ping_" name " " help "\n" \
+               "enhanced_ping_" name "_total %d\n", value)
+
+    APPEND("# TYPE enhanced_ping_run info\n# HELP enhanced_ping_run Run configuration.\n"
+           "enhanced_ping_run_info{target=\"%s\",size=\"%d\",mode=\"%d\"} 1\n",
+           metrics_target, metrics_packet_size, mode + 1);
+    COUNTER("send_count", "Echo requests sent, including retries.", st->send_count);
+    COUNTER("original_send_count", "Echo requests sent, excluding retries.", st->original_send_count);
+    COUNTER("recv_count", "Echo replies received.", st->recv_count);
+    COUNTER("resend_count", "Echo requests retransmitted.", st->resend_count);
+    COUNTER("rereceived_count", "Echo replies received after a retry.", st->rereceived_count);
+    COUNTER("corrupt_count", "Echo replies that failed the checksum or integrity check.", st->corrupt_count);
+
+    // Cumulative buckets from the fine-grained histogram, by bucket midpoint
+    const latency_hist_t *hist = &st->rtt;
+    APPEND("# TYPE enhanced_ping_rtt_seconds histogram\n"
+           "# HELP enhanced_ping_rtt_seconds Round trip time of uncorrupted replies.\n");
+    uint64_t cumulative = 0;
+    int bucket = 0;
+    for (size_t b = 0; b < sizeof(metrics_rtt_bounds) / sizeof(metrics_rtt_bounds[0]); b++) {
+        double bound_ns = metrics_rtt_bounds[b] * 1e9;
+        for (; bucket < HIST_BUCKETS && hist_bucket_value(bucket) <= bound_ns; bucket++) {
+            cumulative += hist->buckets[bucket];
+        }
+        APPEND("enhanced_ping_rtt_seconds_bucket{le=\"%g\"} %llu\n",
+               metrics_rtt_bounds[b], (unsigned long long)cumulative);
+    }
+    APPEND("enhanced_ping_rtt_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)hist->count);
+    APPEND("enhanced_ping_rtt_seconds_count %llu\n", (unsigned long long)hist->count);
+    APPEND("enhanced_ping_rtt_seconds_sum %.9f\n", hist->mean * hist->count / 1000.0);
+    APPEND("# EOF\n");
+
+    #undef COUNTER
+    #undef APPEND
+    return len < size ? len : size - 1;
+}
+
+// Send all of buf, giving up on error
+void send_all(int fd, const char *buf, int len) {
+    while (len > 0) {
+        int n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+// Exporter thread: answer one request per connection
+void *metrics_server_main(void *arg) {
+    int listen_fd = *(int *)arg;
+    free(arg);
+    char *body = malloc(METRICS_BODY_MAX);
+    ping_stats_t *snapshot = malloc(sizeof(ping_stats_t));
+    if (!body || !snapshot) {
+        perror("Failed to allocate metrics buffers");
+        return NULL;
+    }
+
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("metrics accept failed");
+            break;
+        }
+
+        // A client that doesn't send its request promptly is dropped
+        struct timeval tv = { 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        char request[2048];
+        int n = recv(fd, request, sizeof(request) - 1, 0);
+        if (n <= 0) {
+            close(fd);
+            continue;
+        }
+        request[n] = '\0';
+
+        char header[256];
+        int header_len, body_len = 0;
+        if (strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET / ", 6) == 0) {
+            shard_snapshot(&metrics_shard, snapshot);
+            body_len = format_metrics(snapshot, body, METRICS_BODY_MAX);
+            header_len = snprintf(header, sizeof(header),
+                                  "HTTP/1.1 200 OK\r\n"
+                                  "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                                  "Content-Length: %d\r\nConnection: close\r\n\r\n", body_len);
+        } else {
+            header_len = snprintf(header, sizeof(header),
+                                  "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        }
+        send_all(fd, header, header_len);
+        send_all(fd, body, body_len);
+        close(fd);
+    }
+
+    free(body);
+    free(snapshot);
+    close(listen_fd);
+    return NULL;
+}
+
+// Listen on [addr:]port (loopback unless an address is given) and start the
+// exporter thread
+bool start_metrics_server(const char *spec, const char *target, int packet_size) {
+    char host[64] = "127.0.0.1";
+    const char *colon = strrchr(spec, ':');
+    const char *port_str = spec;
+    if (colon) {
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - spec), spec);
+        port_str = colon + 1;
+    }
+    int port = atoi(port_str);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    if (port < 1 || port > 65535 || inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid metrics address '%s'. Use <port> or <ipv4>:<port>.\n", spec);
+        return false;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int on = 1;
+    if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        perror("metrics listener setup failed");
+        if (fd >= 0) close(fd);
+        return false;
+    }
+
+    snprintf(metrics_target, sizeof(metrics_target), "%s", target);
+    metrics_packet_size = packet_size;
+    metrics_enabled = true;
+    metrics_publish(&stats);
+
+    int *arg = malloc(sizeof(int));
+    bool ok = arg != NULL;
+    if (ok) {
+        *arg = fd;
+        ok = start_thread(&metrics_thread, metrics_server_main, arg) == 0;
+    }
+    if (!ok) {
+        perror("Failed to start metrics thread");
+        free(arg);
+        close(fd);
+        metrics_enabled = false;
+        return false;
+    }
+    pthread_detach(metrics_thread);
+    return true;
+}
+
+// Experiment dispatch
+// -------------------------------------------------------------------
+// Run one experiment against dest_addr on sockfd with the engine its options
+// select, accumulating into stats
+void run_experiment(const experiment_t *exp, char *packet) {
+    rto_init(&rto, exp->timeout);
+    if (exp->window > 0 && exp->use_uring) {
+        run_uring(packet, exp->packet_size, exp->count, exp->interval, exp->timeout,
+                  exp->retries, exp->window, exp->pps);
+    } else if (exp->window > 0) {
+        run_pipelined(packet, exp->packet_size, exp->count, exp->interval, exp->timeout,
+                      exp->retries, exp->window, exp->pps);
+    } else if (exp->threads > 0) {
+        run_flood(exp->packet_size, exp->count, exp->interval, exp->timeout, exp->batch,
+                  exp->ttl, exp->threads);
+    } else if (exp->batch > 0) {
+        run_batched(exp->packet_size, exp->count, exp->interval, exp->timeout, exp->batch,
+                    exp->use_ring);
+    } else {
+        run_stop_and_wait(packet, exp->packet_size, exp->count, exp->interval, exp->retries);
+    }
+    report_sched_noise();
+    report_rto(&rto);
+}
+
+// Forget everything the previous experiment recorded
+void reset_run_state(void) {
+    memset(&stats, 0, sizeof(stats));
+    memset(packet_history, 0, sizeof(packet_history));
+    highest_seq = -1;
+    tx_id_next = 0;
+    memset(&sched_noise, 0, sizeof(sched_noise));
+}
+
+// Sweep runner
+// -------------------------------------------------------------------
+// -X runs a matrix of experiments (targets x sizes x modes x counts x
+// intervals) in one process instead of one invocation per cell. The spec file holds
+// "key = values" lines, values separated by spaces or commas, '#' comments:
+//
+//   targets   = 192.168.122.34 1.1.1.1
+//   sizes     = 16 64 512 1472 4096
+//   modes     = 1 2
+//   counts    = 50
+//   intervals = 100
+//   dir       = speed_ping_logs_size_test
+//
+// Keys left out fall back to the command line (-s, -m, -c, -i). Each target
+// gets its own process with its own socket and ICMP identifier, so targets
+// run in parallel while the cells of one target run back to back. Every cell
+// writes its output and statistics to its own log file, named like the
+// Testing_Scripts logs: <dir>/<target>_s<size>_m<mode>_i<interval>ms.log.
+typedef struct {
+    char *targets[MAX_SWEEP_VALUES];
+    int target_count;
+    int sizes[MAX_SWEEP_VALUES];
+    int size_count;
+    int modes[MAX_SWEEP_VALUES];
+    int mode_count;
+    int counts[MAX_SWEEP_VALUES];
+    int count_count;
+    int intervals[MAX_SWEEP_VALUES];
+    int interval_count;
+    char *dir;
+} sweep_spec_t;
+
+// Parse a list of integers in [min, max] into values; false if one is
+// malformed or out of range
+bool parse_sweep_ints(char *list, int *values, int *n, const char *key, int line_no,
+                      long min, long max) {
+    for (char *tok = strtok(list, " \t,"); tok; tok = strtok(NULL, " \t,")) {
+        char *end;
+        long v = strtol(tok, &end, 10);
+        if (*end != '\0' || end == tok) {
+            fprintf(stderr, "Sweep spec line %d: bad %s value '%s'.\n", line_no, key, tok);
+            return false;
+        }
+        if (v < min || v > max) {
+            fprintf(stderr, "Sweep spec line %d: %s must be between %ld and %ld, not %s.\n",
+                    line_no, key, min, max, tok);
+            return false;
+        }
+        if (*n == MAX_SWEEP_VALUES) {
+            fprintf(stderr, "Sweep spec line %d: more than %d %s.\n", line_no, MAX_SWEEP_VALUES, key);
+            return false;
+        }
+        values[(*n)++] = (int)v;
+    }
+    return true;
+}
+
+// Read a sweep spec; false (with a message) if it can't be used
+bool read_sweep_spec(const char *path, sweep_spec_t *spec) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror("Failed to open sweep spec");
+        return false;
+    }
+
+    char line[4096];
+    int line_no = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), f)) {
+        line_no++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        line[strcspn(line, "\r\n")] = '\0';
+
+        char *eq = strchr(line, '=');
+        char key[32];
+        if (!eq) {
+            if (strspn(line, " \t") != strlen(line)) {
+                fprintf(stderr, "Sweep spec line %d: expected 'key = values'.\n", line_no);
+                ok = false;
+            }
+            continue;
+        }
+        *eq = '\0';
+        if (sscanf(line, "%31s", key) != 1) {
+            fprintf(stderr, "Sweep spec line %d: missing key.\n", line_no);
+            ok = false;
+            continue;
+        }
+
+        char *values = eq + 1;
+        if (strcmp(key, "targets") == 0) {
+            for (char *tok = strtok(values, " \t,"); ok && tok; tok = strtok(NULL, " \t,")) {
+                if (spec->target_count == MAX_SWEEP_VALUES) {
+                    fprintf(stderr, "Sweep spec line %d: more than %d targets.\n", line_no, MAX_SWEEP_VALUES);
+                    ok = false;
+                } else {
+                    spec->targets[spec->target_count++] = strdup(tok);
+                }
+            }
+        } else if (strcmp(key, "sizes") == 0) {
+            // Sizes too small for the payload options are skipped per cell
+            ok = parse_sweep_ints(values, spec->sizes, &spec->size_count, key, line_no,
+                                  sizeof(struct icmphdr), MAX_PACKET_SIZE);
+        } else if (strcmp(key, "modes") == 0) {
+            ok = parse_sweep_ints(values, spec->modes, &spec->mode_count, key, line_no, 1, 3);
+        } else if (strcmp(key, "counts") == 0) {
+            ok = parse_sweep_ints(values, spec->counts, &spec->count_count, key, line_no, 1, INT_MAX);
+        } else if (strcmp(key, "intervals") == 0) {
+            ok = parse_sweep_ints(values, spec->intervals, &spec->interval_count, key, line_no, 0, INT_MAX);
+        } else if (strcmp(key, "dir") == 0) {
+            char dir[PATH_MAX];
+            if (sscanf(values, "%4095s", dir) == 1) {
+                free(spec->dir);
+                spec->dir = strdup(dir);
+            }
+        } else {
+            fprintf(stderr, "Sweep spec line %d: unknown key '%s'.\n", line_no, key);
+            ok = false;
+        }
+    }
+    fclose(f);
+
+    if (ok && spec->target_count == 0) {
+        fprintf(stderr, "Sweep spec has no targets.\n");
+        ok = false;
+    }
+    return ok;
+}
+
+void free_sweep_spec(sweep_spec_t *spec) {
+    for (int i = 0; i < spec->target_count; i++) {
+        free(spec->targets[i]);
+    }
+    free(spec->dir);
+}
+
+// Run every cell for one target, in a child process; returns its exit status
+int run_sweep_target(const sweep_spec_t *spec, const char *name, struct in_addr addr,
+                     const experiment_t *base, const char *rate_arg) {
+    ident = getpid() & 0xFFFF;
+    log_to_stdout = false;
+
+    // Our own socket, so the kernel filter only lets through this target's replies
+    close(sockfd);
+    sockfd = open_probe_socket(base->ttl, base->timeout);
+    if (sockfd < 0) {
+        return EXIT_FAILURE;
+    }
+    if (kernel_timestamps && !enable_kernel_timestamps(sockfd)) {
+        perror("setsockopt SO_TIMESTAMPING failed, using CLOCK_MONOTONIC");
+        kernel_timestamps = false;
+    }
+    memset(&dest_addr, 0, sizeof(dest_addr));
+    dest_addr.sin_family = AF_INET;
+    dest_addr.sin_addr = addr;
+    if (!dgram_socket && !attach_reply_filter(sockfd, ident, &dest_addr.sin_addr.s_addr, 1)) {
+        perror("setsockopt SO_ATTACH_FILTER failed");
+    }
+
+    char *packet = malloc(MAX_PACKET_SIZE);
+    if (!packet) {
+        perror("Failed to allocate memory for packet");
+        close(sockfd);
+        return EXIT_FAILURE;
+    }
+    log_start();
+
+    char file_stem[256];
+    snprintf(file_stem, sizeof(file_stem), "%s", name);
+    for (char *c = file_stem; *c; c++) {
+        if (*c == '.' || *c == ':' || *c == '/') *c = '_';
+    }
+
+    int min_size = sizeof(struct icmphdr) + 8;
+    if (integrity_mode == INTEGRITY_CRC32C) {
+        min_size = sizeof(struct icmphdr) + sizeof(struct timeval) + sizeof(uint32_t);
+    }
+
+    for (int si = 0; si < spec->size_count && !stop_ping; si++)
+    for (int mi = 0; mi < spec->mode_count && !stop_ping; mi++)
+    for (int ci = 0; ci < spec->count_count && !stop_ping; ci++)
+    for (int ii = 0; ii < (spec->interval_count ? spec->interval_count : 1) && !stop_ping; ii++) {
+        experiment_t exp = *base;
+        exp.packet_size = spec->sizes[si];
+        exp.count = spec->counts[ci];
+        mode = spec->modes[mi] - 1;
+        if (spec->interval_count) {
+            exp.interval = spec->intervals[ii];
+        } else if (exp.interval < 0) {
+            exp.interval = get_ping_interval();
+        }
+
+        if (exp.packet_size < min_size || exp.packet_size > MAX_PACKET_SIZE) {
+            printf("%s s%d m%d: skipped, packet size must be between %d and %d bytes\n",
+                   name, exp.packet_size, spec->modes[mi], min_size, MAX_PACKET_SIZE);
+            continue;
+        }
+        if (rate_arg) {
+            exp.pps = parse_rate(rate_arg, exp.packet_size);
+        }
+
+        // Several counts for the same cell would share a file name otherwise
+        char log_path[PATH_MAX];
+        int len = snprintf(log_path, sizeof(log_path), "%s/%s_s%d_m%d_i%dms",
+                           spec->dir ? spec->dir : ".", file_stem, exp.packet_size,
+                           spec->modes[mi], exp.interval);
+        if (spec->count_count > 1) {
+            len += snprintf(log_path + len, sizeof(log_path) - len, "_c%d", exp.count);
+        }
+        snprintf(log_path + len, sizeof(log_path) - len, ".log");
+        logfile = fopen(log_path, "w");
+        if (!logfile) {
+            perror(log_path);
+            continue;
+        }
+
+        reset_run_state();
+        get_payload_template(exp.packet_size);
+        log_message("PING %s (%s): %d bytes of data with %s mode\n",
+                    name, inet_ntoa(addr), exp.packet_size - (int)sizeof(struct icmphdr),
+                    mode == MODE_STANDARD ? "standard" :
+                      (mode == MODE_AGGRESSIVE ? "aggressive" : "intermittent"));
+        long long start_ns = monotonic_ns();
+        run_experiment(&exp, packet);
+        print_statistics();
+        log_flush();
+        fclose(logfile);
+        logfile = NULL;
+
+        int sent = stats.original_send_count;
+        printf("%s s%d m%d i%dms c%d: %d/%d received (%.1f%% loss), %d corrupted, "
+               "avg %.3f ms, p99 %.3f ms, %.1f s -> %s\n",
+               name, exp.packet_size, spec->modes[mi], exp.interval, exp.count,
+               stats.recv_count, sent,
+               sent > 0 ? 100.0 * (sent - stats.recv_count) / sent : 0.0,
+               stats.corrupt_count, stats.rtt.count > 0 ? stats.rtt.mean : 0.0,
+               stats.rtt.count > 0 ? hist_percentile(&stats.rtt, 0.99) : 0.0,
+               (monotonic_ns() - start_ns) / 1e9, log_path);
+        fflush(stdout);
+    }
+
+    log_stop();
+    free(packet);
+    close(sockfd);
+    return EXIT_SUCCESS;
+}
+
+// Run a sweep spec: one process per target, all in parallel
+int run_sweep(const char *spec_path, const experiment_t *base, const char *rate_arg) {
+    sweep_spec_t spec = {0};
+    if (!read_sweep_spec(spec_path, &spec)) {
+        free_sweep_spec(&spec);
+        return EXIT_FAILURE;
+    }
+
+    // Unlisted dimensions come from the command line
+    if (spec.size_count == 0) {
+        spec.sizes[spec.size_count++] = base->packet_size;
+    }
+    if (spec.mode_count == 0) {
+        spec.modes[spec.mode_count++] = mode + 1;
+    }
+    if (spec.count_count == 0) {
+        if (base->count < 1) {
+            fprintf(stderr, "A sweep needs a probe count: give -c or a counts line.\n");
+            free_sweep_spec(&spec);
+            return EXIT_FAILURE;
+        }
+        spec.counts[spec.count_count++] = base->count;
+    }
+    if (spec.dir && mkdir(spec.dir, 0755) < 0 && errno != EEXIST) {
+        perror(spec.dir);
+        free_sweep_spec(&spec);
+        return EXIT_FAILURE;
+    }
+
+    // Resolve everything up front so a typo fails before anything is sent
+    struct in_addr addrs[MAX_SWEEP_VALUES];
+    for (int i = 0; i < spec.target_count; i++) {
+        struct hostent *host_entity = gethostbyname(spec.targets[i]);
+        if (!host_entity) {
+            fprintf(stderr, "Cannot resolve sweep target '%s'.\n", spec.targets[i]);
+            free_sweep_spec(&spec);
+            return EXIT_FAILURE;
+        }
+        addrs[i] = *(struct in_addr *)host_entity->h_addr;
+    }
+
+    int interval_count = spec.interval_count ? spec.interval_count : 1; // Else the -i interval
+    int cells = spec.target_count * spec.size_count * spec.mode_count * spec.count_count * interval_count;
+    printf("Sweep: %d targets x %d sizes x %d modes x %d counts x %d intervals = %d cells\n",
+           spec.target_count, spec.size_count, spec.mode_count, spec.count_count, interval_count, cells);
+    fflush(stdout);
+
+    long long start_ns = monotonic_ns();
+    pid_t pids[MAX_SWEEP_VALUES];
+    int started = 0;
+    for (int i = 0; i < spec.target_count; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            exit(run_sweep_target(&spec, spec.targets[i], addrs[i], base, rate_arg));
+        }
+        if (pids[i] < 0) {
+            perror("fork failed");
+            continue;
+        }
+        started++;
+    }
+
+    int failed = spec.target_count - started;
+    for (int i = 0; i < spec.target_count; i++) {
+        int status;
+        if (pids[i] > 0 && (waitpid(pids[i], &status, 0) < 0 ||
+                            !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)) {
+            failed++;
+        }
+    }
+
+    printf("Sweep: %d cells on %d targets in %.1f s%s\n", cells, spec.target_count,
+           (monotonic_ns() - start_ns) / 1e9, failed ? " (some targets failed)" : "");
+    free_sweep_spec(&spec);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Micro-benchmarks
+// -------------------------------------------------------------------
+// With -o every figure is also written to that file as a CSV row (benchmark,
+// variant, payload bytes, ns per operation), so runs on different commits can
+// be compared by script.
+FILE *bench_csv = NULL;
+
+void bench_record(const char *benchmark, const char *variant, int payload, double ns) {
+    if (bench_csv) {
+        fprintf(bench_csv, "%s,%s,%d,%.2f\n", benchmark, variant, payload, ns);
+    }
+}
+
+// The checksum as originally written, one 16-bit word at a time; kept as the
+// reference the faster versions must agree with
+unsigned short checksum_reference(const unsigned short *buf, int size) {
+    unsigned long sum = 0;
+    while (size > 1) {
+        sum += *buf++;
+        size -= 2;
+    }
+    if (size == 1) {
+        sum += *(const unsigned char *)buf;
+    }
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum += (sum >> 16);
+    return (unsigned short)(~sum);
+}
+
+typedef struct {
+    const char *name;
+    uint64_t (*add)(const void *, int, uint64_t);
+} checksum_impl_t;
+
+// Nanoseconds per call of impl over `size` bytes
+double time_checksum(const checksum_impl_t *impl, const unsigned char *buf, int size) {
+    int iterations = (int)(256LL * 1024 * 1024 / (size + 64));
+    volatile unsigned short sink = 0;
+    long long start_ns = monotonic_ns();
+    for (int i = 0; i < iterations; i++) {
+        sink += checksum_fold(impl->add(buf, size, 0));
+    }
+    (void)sink;
+    return (double)(monotonic_ns() - start_ns) / iterations;
+}
+
+// Check every checksum implementation against the reference, then time them
+// and the incremental restamp over the payload sizes used in the experiments
+int run_checksum_benchmark(void) {
+    static const int sizes[] = { 16, 64, 256, 1024, 1472, 8192, 32768, 65515 };
+    checksum_impl_t impls[3] = { { "scalar", checksum_add_scalar } };
+    int impl_count = 1;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) impls[impl_count++] = (checksum_impl_t){ "sse2", checksum_add_sse2 };
+    if (__builtin_cpu_supports("avx2")) impls[impl_count++] = (checksum_impl_t){ "avx2", checksum_add_avx2 };
+#endif
+
+    unsigned char *buf = malloc(MAX_PACKET_SIZE + 64);
+    if (!buf) {
+        perror("Failed to allocate benchmark buffer");
+        return EXIT_FAILURE;
+    }
+
+    // Bit-exactness: every length up to 4 KB plus the benchmark sizes, at odd
+    // and even offsets, with random and all-ones data
+    int checked = 0;
+    for (int fill = 0; fill < 2; fill++) {
+        for (int i = 0; i < MAX_PACKET_SIZE + 64; i++) {
+            buf[i] = fill ? 0xFF : rand() & 0xFF;
+        }
+        for (int size = 0; size <= 4096 + 8; size++) {
+            for (int offset = 0; offset < 2; offset++) {
+                int n = size <= 4096 ? size : sizes[size - 4097];
+                unsigned short expected = checksum_reference((unsigned short *)(buf + offset), n);
+                for (int k = 0; k < impl_count; k++) {
+                    unsigned short got = checksum_fold(impls[k].add(buf + offset, n, 0));
+                    if (got != expected) {
+                        log_message("Checksum mismatch: %s, %d bytes at offset %d: 0x%04x != 0x%04x\n",
+                                    impls[k].name, n, offset, got, expected);
+                        free(buf);
+                        return EXIT_FAILURE;
+                    }
+                    checked++;
+                }
+            }
+        }
+    }
+
+    // Restamping must leave the same checksum as building the packet from scratch
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+        int packet_size = sizes[s] + sizeof(struct icmphdr);
+        struct icmphdr *icmp_header = (struct icmphdr *)buf;
+        prepare_icmp_packet(icmp_header, 0, packet_size);
+        for (int seq = 1; seq < 70000; seq += 997) {
+            restamp_icmp_packet(icmp_header, seq, packet_size);
+            unsigned short restamped = icmp_header->checksum;
+            icmp_header->checksum = 0;
+            if (checksum_reference((unsigned short *)icmp_header, packet_size) != restamped) {
+                log_message("Restamp mismatch: %d bytes, seq %d\n", packet_size, seq);
+                free(buf);
+                return EXIT_FAILURE;
+            }
+            icmp_header->checksum = restamped;
+            checked++;
+        }
+    }
+    log_message("Checksum: %d cases bit-exact with the reference\n\n", checked);
+
+    // Timing
+    log_message("%8s", "payload");
+    for (int k = 0; k < impl_count; k++) {
+        log_message(" %18s", impls[k].name);
+    }
+    log_message(" %18s %18s\n", "build", "restamp");
+
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+        int packet_size = sizes[s] + sizeof(struct icmphdr);
+        log_message("%8d", sizes[s]);
+
+        double scalar_ns = 0;
+        for (int k = 0; k < impl_count; k++) {
+            double ns = time_checksum(&impls[k], buf, packet_size);
+            if (k == 0) scalar_ns = ns;
+            log_message(" %9.1f ns %5.1fx", ns, scalar_ns / ns);
+            bench_record("checksum", impls[k].name, sizes[s], ns);
+        }
+
+        // Building a packet from the template, then restamping it
+        struct icmphdr *icmp_header = (struct icmphdr *)buf;
+        int iterations = (int)(256LL * 1024 * 1024 / (packet_size + 64));
+        long long start_ns = monotonic_ns();
+        for (int i = 0; i < iterations; i++) {
+            prepare_icmp_packet(icmp_header, i, packet_size);
+        }
+        double ns = (double)(monotonic_ns() - start_ns) / iterations;
+        log_message(" %9.1f ns %5.1fx", ns, scalar_ns / ns);
+        bench_record("checksum", "build", sizes[s], ns);
+
+        iterations = 1000000;
+        start_ns = monotonic_ns();
+        for (int i = 0; i < iterations; i++) {
+            restamp_icmp_packet(icmp_header, i, packet_size);
+        }
+        ns = (double)(monotonic_ns() - start_ns) / iterations;
+        log_message(" %9.1f ns %5.1fx\n", ns, scalar_ns / ns);
+        bench_record("checksum", "restamp", sizes[s], ns);
+    }
+
+    free(buf);
+    return EXIT_SUCCESS;
+}
+
+// The pattern check as originally written, one byte at a time
+bool pattern_reference(const unsigned char *ptr, int len) {
+    for (int i = 0; i < len; i++) {
+        if (ptr[i] != (i & 0xFF)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    const char *name;
+    bool (*differs)(const unsigned char *, const unsigned char *, int);
+} compare_impl_t;
+
+typedef struct {
+    const char *name;
+    uint32_t (*crc)(const void *, int, uint32_t);
+} crc_impl_t;
+
+// Check the payload compare and CRC32C implementations, then time them
+// against the original byte loop over the same payload sizes
+int run_integrity_benchmark(void) {
+    static const int sizes[] = { 16, 64, 256, 1024, 1472, 8192, 32768, 65515 };
+    compare_impl_t compares[3] = { { "memcmp", payload_differs_scalar } };
+    crc_impl_t crcs[2] = { { "crc32c sw", crc32c_sw } };
+    int compare_count = 1, crc_count = 1;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) compares[compare_count++] = (compare_impl_t){ "sse2", payload_differs_sse2 };
+    if (__builtin_cpu_supports("avx2")) compares[compare_count++] = (compare_impl_t){ "avx2", payload_differs_avx2 };
+#endif
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) crcs[crc_count++] = (crc_impl_t){ "crc32c hw", crc32c_hw };
+#endif
+
+    unsigned char *pattern = malloc(MAX_PACKET_SIZE);
+    unsigned char *payload = malloc(MAX_PACKET_SIZE);
+    if (!pattern || !payload) {
+        perror("Failed to allocate benchmark buffer");
+        free(pattern);
+        free(payload);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < MAX_PACKET_SIZE; i++) {
+        pattern[i] = i & 0xFF;
+    }
+    memcpy(payload, pattern, MAX_PACKET_SIZE);
+
+    // Every compare must catch a single flipped byte anywhere, and the CRC32C
+    // versions must agree with each other and with the standard check value
+    int checked = 0;
+    bool ok = crc32c_sw("123456789", 9, 0) == 0xE3069283;
+    for (int len = 0; ok && len <= 1024; len++) {
+        for (int k = 0; ok && k < compare_count; k++) {
+            ok = !compares[k].differs(payload, pattern, len);
+            for (int pos = 0; ok && pos < len; pos++) {
+                payload[pos] ^= 0x10;
+                ok = compares[k].differs(payload, pattern, len);
+                payload[pos] ^= 0x10;
+                checked++;
+            }
+        }
+        for (int k = 1; ok && k < crc_count; k++) {
+            ok = crcs[k].crc(payload + (len & 7), len, 0) == crc32c_sw(payload + (len & 7), len, 0);
+            checked++;
+        }
+    }
+    if (!ok) {
+        log_message("Integrity check implementations disagree\n");
+        free(pattern);
+        free(payload);
+        return EXIT_FAILURE;
+    }
+    log_message("Integrity: %d cases agree with the reference\n\n", checked);
+
+    // Timing
+    log_message("%8s %18s", "payload", "byte loop");
+    for (int k = 0; k < compare_count; k++) {
+        log_message(" %18s", compares[k].name);
+    }
+    for (int k = 0; k < crc_count; k++) {
+        log_message(" %18s", crcs[k].name);
+    }
+    log_message("\n");
+
+    volatile uint32_t sink = 0;
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+        int len = sizes[s] - sizeof(struct timeval);
+        if (len < 0) len = 0;
+        int iterations = (int)(256LL * 1024 * 1024 / (len + 64));
+        log_message("%8d", sizes[s]);
+
+        long long start_ns = monotonic_ns();
+        for (int i = 0; i < iterations; i++) {
+            sink += pattern_reference(payload, len);
+        }
+        double reference_ns = (double)(monotonic_ns() - start_ns) / iterations;
+        log_message(" %9.1f ns %5.1fx", reference_ns, 1.0);
+        bench_record("integrity", "byte loop", sizes[s], reference_ns);
+
+        for (int k = 0; k < compare_count; k++) {
+            start_ns = monotonic_ns();
+            for (int i = 0; i < iterations; i++) {
+                sink += compares[k].differs(payload, pattern, len);
+            }
+            double ns = (double)(monotonic_ns() - start_ns) / iterations;
+            log_message(" %9.1f ns %5.1fx", ns, reference_ns / ns);
+            bench_record("integrity", compares[k].name, sizes[s], ns);
+        }
+        for (int k = 0; k < crc_count; k++) {
+            start_ns = monotonic_ns();
+            for (int i = 0; i < iterations; i++) {
+                sink += crcs[k].crc(payload, len, 0);
+            }
+            double ns = (double)(monotonic_ns() - start_ns) / iterations;
+            log_message(" %9.1f ns %5.1fx", ns, reference_ns / ns);
+            bench_record("integrity", crcs[k].name, sizes[s], ns);
+        }
+        log_message("\n");
+    }
+    (void)sink;
+
+    free(pattern);
+    free(payload);
+    return EXIT_SUCCESS;
+}
+
+// Nanoseconds per call of a hot-path step, timed `iterations` times
+#define TIME_NS(iterations, expr) ({ \
+    long long start_ns_ = monotonic_ns(); \
+    for (int i = 0; i < (iterations); i++) { expr; } \
+    (double)(monotonic_ns() - start_ns_) / (iterations); \
+})
+
+// Time the per-probe functions as the engines call them, with whichever
+// checksum and compare versions this CPU dispatched to: building a probe,
+// checksumming it, and both halves of checking a reply, with the payload
+// pattern and with -C. Then the history ring's insert and lookups.
+int run_hotpath_benchmark(void) {
+    static const int sizes[] = { 16, 64, 256, 1024, 1472, 8192, 32768, 65515 };
+    unsigned char *buf = malloc(MAX_PACKET_SIZE + 64);
+    if (!buf) {
+        perror("Failed to allocate benchmark buffer");
+        return EXIT_FAILURE;
+    }
+    struct icmphdr *icmp_header = (struct icmphdr *)buf;
+    integrity_mode_t saved_mode = integrity_mode;
+    volatile unsigned int sink = 0;
+    bool ok = true;
+
+    log_message("%8s %18s %18s %18s %18s %18s\n", "payload", "checksum", "prepare",
+                "verify checksum", "verify pattern", "verify crc32c");
+    for (int s = 0; ok && s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+        int packet_size = sizes[s] + sizeof(struct icmphdr);
+        int iterations = (int)(256LL * 1024 * 1024 / (packet_size + 64));
+
+        integrity_mode = INTEGRITY_PATTERN;
+        prepare_icmp_packet(icmp_header, 0, packet_size);
+        double checksum_ns = TIME_NS(iterations, sink += calculate_checksum((unsigned short *)buf, packet_size));
+        double prepare_ns = TIME_NS(iterations, prepare_icmp_packet(icmp_header, i, packet_size));
+        double verify_ns = TIME_NS(iterations, sink += verify_checksum((unsigned short *)buf, packet_size));
+        double pattern_ns = TIME_NS(iterations, sink += verify_packet_integrity(icmp_header, sizes[s]));
+        ok = verify_checksum((unsigned short *)buf, packet_size) && verify_packet_integrity(icmp_header, sizes[s]);
+
+        integrity_mode = INTEGRITY_CRC32C;
+        prepare_icmp_packet(icmp_header, 0, packet_size);
+        double crc_ns = TIME_NS(iterations, sink += verify_packet_integrity(icmp_header, sizes[s]));
+        ok = ok && verify_packet_integrity(icmp_header, sizes[s]);
+
+        log_message("%8d %15.1f ns %15.1f ns %15.1f ns %15.1f ns %15.1f ns\n", sizes[s],
+                    checksum_ns, prepare_ns, verify_ns, pattern_ns, crc_ns);
+        bench_record("hotpath", "calculate_checksum", sizes[s], checksum_ns);
+        bench_record("hotpath", "prepare_icmp_packet", sizes[s], prepare_ns);
+        bench_record("hotpath", "verify_checksum", sizes[s], verify_ns);
+        bench_record("hotpath", "verify_packet_integrity", sizes[s], pattern_ns);
+        bench_record("hotpath", "verify_packet_integrity -C", sizes[s], crc_ns);
+    }
+    integrity_mode = saved_mode; // The template is rebuilt for it on next use
+    free(buf);
+    if (!ok) {
+        log_message("A freshly built probe failed its own checksum or integrity check\n");
+        return EXIT_FAILURE;
+    }
+
+    // History: fill the ring several times over, then look up probes still
+    // in it (hits), and ones a later generation has overwritten (misses)
+    const int count = HISTORY_SIZE * 8;
+    double add_ns = TIME_NS(count, add_packet_to_history(i));
+    unsigned int seed = 1;
+    int hits = 0, misses = 0;
+    double hit_ns = TIME_NS(count, hits += find_packet(count - 1 - rand_r(&seed) % HISTORY_SIZE) != NULL);
+    double miss_ns = TIME_NS(count, misses += find_packet(count - 1 - HISTORY_SIZE - rand_r(&seed) % HISTORY_SIZE) == NULL);
+    double unwrap_ns = TIME_NS(count, sink += unwrap_sequence((unsigned short)(count - 1 - i % 32768)));
+    (void)sink;
+    memset(packet_history, 0, sizeof(packet_history));
+    highest_seq = -1;
+    if (hits != count || misses != count) {
+        log_message("Packet history lookup returned a reused slot or missed a live one\n");
+        return EXIT_FAILURE;
+    }
+    log_message("\nHistory: %d probes through a %d-slot ring, lookups hit and miss as expected\n",
+                count, HISTORY_SIZE);
+    log_message("  add %.1f ns, find (hit) %.1f ns, find (reused slot) %.1f ns, unwrap sequence %.1f ns\n",
+                add_ns, hit_ns, miss_ns, unwrap_ns);
+    bench_record("history", "add_packet_to_history", 0, add_ns);
+    bench_record("history", "find_packet hit", 0, hit_ns);
+    bench_record("history", "find_packet miss", 0, miss_ns);
+    bench_record("history", "unwrap_sequence", 0, unwrap_ns);
+    return EXIT_SUCCESS;
+}
+
+// Bookkeeping for one timer of the wheel benchmark
+typedef struct {
+    wheel_timer_t timer;
+    long long due_us;
+    bool cancelled;
+    bool fired;
+} bench_timer_t;
+
+// Schedule half a million timers over 5 s, cancel a quarter of them and expire
+// the rest in event-loop passes, checking that each fires exactly once, in the
+// first pass at or after its expiry; then time the operations
+int run_wheel_benchmark(void) {
+    const int count = 500000;
+    const long long span_us = 5000000;
+    bench_timer_t *timers = calloc(count, sizeof(bench_timer_t));
+    timer_wheel_t *wheel = malloc(sizeof(timer_wheel_t));
+    if (!timers || !wheel) {
+        perror("Failed to allocate benchmark timers");
+        free(timers);
+        free(wheel);
+        return EXIT_FAILURE;
+    }
+    wheel_init(wheel, 0);
+    unsigned int seed = 1;
+
+    long long start_ns = monotonic_ns();
+    for (int i = 0; i < count; i++) {
+        timers[i].due_us = rand_r(&seed) % span_us;
+        wheel_schedule(wheel, &timers[i].timer, timers[i].due_us);
+    }
+    double schedule_ns = (double)(monotonic_ns() - start_ns) / count;
+
+    int cancelled = 0;
+    start_ns = monotonic_ns();
+    for (int i = 0; i < count; i += 4) {
+        wheel_cancel(wheel, &timers[i].timer);
+        timers[i].cancelled = true;
+        cancelled++;
+    }
+    double cancel_ns = (double)(monotonic_ns() - start_ns) / cancelled;
+
+    // Each pass either sleeps until the wheel's next work or wakes a little
+    // later at random, like a loop woken by replies
+    long long now_us = 0, previous_us = -1;
+    int passes = 0, fired = 0;
+    bool ok = true;
+    start_ns = monotonic_ns();
+    while (ok && wheel->count > 0) {
+        long long next_us = wheel_next_us(wheel);
+        now_us = (rand_r(&seed) & 1) ? next_us : now_us + 1 + rand_r(&seed) % 1000;
+        wheel_timer_t *timer;
+        while ((timer = wheel_expire(wheel, now_us)) != NULL) {
+            bench_timer_t *b = (bench_timer_t *)((char *)timer - offsetof(bench_timer_t, timer));
+            ok = ok && !b->cancelled && !b->fired && b->due_us <= now_us && b->due_us > previous_us;
+            b->fired = true;
+            fired++;
+        }
+        previous_us = now_us;
+        passes++;
+    }
+    double expire_ns = (double)(monotonic_ns() - start_ns) / (fired > 0 ? fired : 1);
+    ok = ok && fired == count - cancelled;
+
+    free(timers);
+    free(wheel);
+    if (!ok) {
+        log_message("Timer wheel fired a timer early, late, twice or not at all\n");
+        return EXIT_FAILURE;
+    }
+    log_message("Timer wheel: %d timers over %lld s, %d cancelled, the rest fired on time in %d passes\n",
+                count, span_us / 1000000, cancelled, passes);
+    log_message("  schedule %.1f ns, cancel %.1f ns, expire %.1f ns per timer\n",
+                schedule_ns, cancel_ns, expire_ns);
+    bench_record("wheel", "schedule", 0, schedule_ns);
+    bench_record("wheel", "cancel", 0, cancel_ns);
+    bench_record("wheel", "expire", 0, expire_ns);
+    return EXIT_SUCCESS;
+}
+
+// Run every micro-benchmark (-b), writing the figures to csv_name if given
+int run_benchmarks(const char *csv_name) {
+    if (csv_name) {
+        bench_csv = fopen(csv_name, "w");
+        if (!bench_csv) {
+            perror(csv_name);
+            return EXIT_FAILURE;
+        }
+        fprintf(bench_csv, "benchmark,variant,payload,ns_per_op\n");
+    }
+
+    int status = run_checksum_benchmark();
+    if (status == EXIT_SUCCESS) {
+        log_message("\n");
+        status = run_integrity_benchmark();
+    }
+    if (status == EXIT_SUCCESS) {
+        log_message("\n");
+        status = run_hotpath_benchmark();
+    }
+    if (status == EXIT_SUCCESS) {
+        log_message("\n");
+        status = run_wheel_benchmark();
+    }
+
+    if (bench_csv && fclose(bench_csv) != 0) {
+        perror(csv_name);
+        status = EXIT_FAILURE;
+    }
+    bench_csv = NULL;
+    return status;
+}
+
+// Handle signals (Ctrl+C)
+// Only stops the run: the engine returns and main() prints the statistics and
+// closes the logger, results file and socket as usual
+void signal_handler(int signo) {
+    if (signo == SIGINT) {
+        stop_ping = 1;
+    }
+}
+
+// Print usage information
+void print_usage(char *prog_name) {
+    fprintf(stderr, "Usage: %s <hostname/IP> [more hosts...] [options]\n", prog_name);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -s <size>      Packet size (default: %d)\n", PACKET_SIZE);
+    fprintf(stderr, "  -t <ttl>       Time to live (default: %d)\n", DEFAULT_TTL);
+    fprintf(stderr, "  -c <count>     Number of packets to send (default: infinite)\n");
+    fprintf(stderr, "  -i <interval>  Wait interval in ms (default: mode dependent)\n");
+    fprintf(stderr, "  -w <timeout>   Response timeout in seconds (default: %d)\n", MAX_WAIT_TIME);
+    fprintf(stderr, "  -A <min_ms>    Adaptive timeout: RTO from smoothed RTT and variance, at least <min_ms>, at most -w\n");
+    fprintf(stderr, "  -r <retries>   Number of retries per packet (default: %d)\n", MAX_RETRY);
+    fprintf(stderr, "  -m <mode>      Experiment mode (1=standard, 2=aggressive, 3=intermittent)\n");
+    fprintf(stderr, "  -P <threads>   Multi-core flood: <threads> pinned workers, each batching like -B (max %d)\n", MAX_THREADS);
+    fprintf(stderr, "  -B <batch>     Batch flood mode: sendmmsg()/recvmmsg() <batch> probes at a time (max %d)\n", MAX_BATCH);
+    fprintf(stderr, "  -p <rate>      Paced open-loop mode: send at <rate> pps, or bits/s with a bps suffix (e.g. 20k, 100Mbps)\n");
+    fprintf(stderr, "  -R             Batch mode: receive through a TPACKET_V3 ring (implies -T)\n");
+    fprintf(stderr, "  -U             Use the io_uring backend for pipelined mode (falls back to select())\n");
+    fprintf(stderr, "  -T             Use kernel RX/TX timestamps for RTT\n");
+    fprintf(stderr, "  -C             Embed a CRC32C of the payload and check replies against it\n");
+    fprintf(stderr, "  -d             Unprivileged ICMP datagram socket instead of a raw one (see net.ipv4.ping_group_range)\n");
+    fprintf(stderr, "  -W <window>    Pipelined mode: keep up to <window> probes in flight (max %d)\n", MAX_WINDOW);
+    fprintf(stderr, "  -f <file>      Read targets from file (one host [interval_ms] per line)\n");
+    fprintf(stderr, "  -l <file>      Log file name\n");
+    fprintf(stderr, "  -o <file>      Also write every probe's outcome to <file> as fixed-size binary records\n");
+    fprintf(stderr, "  -D <file>      Print a -o results file as CSV (<file>:first-last for a sequence range) and exit\n");
+    fprintf(stderr, "  -M <[ip:]port> Serve live counters and the RTT histogram in OpenMetrics format (default ip 127.0.0.1)\n");
+    fprintf(stderr, "  -J <cpu>[:prio] Low-jitter mode: pin to <cpu> (SCHED_FIFO at <prio>), lock memory, busy-poll\n");
+    fprintf(stderr, "  -v <level>     Stdout verbosity: 0=summaries only, 1=also timeouts/errors, 2=every reply (default)\n");
+    fprintf(stderr, "  -X <spec>      Sweep: run the target/size/mode/count matrix in <spec>, one log per cell\n");
+    fprintf(stderr, "  -b             Benchmark the checksum, integrity check, per-probe hot path, history and timer wheel, then exit\n");
+    fprintf(stderr, "  -e <file>      With -b, also write the benchmark figures to <file> as CSV\n");
+    fprintf(stderr, "  -h             Show this help message\n");
 }
 
 // Main function
@@ -339,6 +5678,21 @@ int main(int argc, char *argv[]) {
     int interval = -1; // Will be set based on mode
     int timeout = MAX_WAIT_TIME;
     int retries = MAX_RETRY;
+    int window = 0;    // 0 = stop-and-wait
+    int batch = 0;     // 0 = no batching
+    int threads = 0;   // 0 = single-threaded
+    bool use_uring = false;
+    bool use_ring = false;
+    char *rate_arg = NULL;  // -p: paced open-loop rate
+    double pps = 0;
+    char *target_file = NULL;
+    char *sweep_spec = NULL;  // -X: run a matrix of experiments
+    char *results_name = NULL;  // -o: binary per-probe results
+    bool benchmark = false;     // -b: run the micro-benchmarks and exit
+    char *bench_csv_name = NULL; // -e: CSV of the benchmark figures
+    char *metrics_arg = NULL;   // -M: OpenMetrics listener
+    int jitter_cpu = -1;        // -J: low-jitter mode on this CPU
+    int jitter_priority = 0;    // -J: SCHED_FIFO priority (0 = stay SCHED_OTHER)
     
     // Initialize random seed
     srand(time(NULL));
@@ -348,7 +5702,7 @@ int main(int argc, char *argv[]) {
     
     // Parse args
     int opt;
-    while ((opt = getopt(argc, argv, "s:t:c:i:w:r:m:l:h")) != -1) {
+    while ((opt = getopt(argc, argv, "s:t:c:i:w:r:m:W:B:P:p:X:A:RUTCdf:l:o:D:M:J:v:be:h")) != -1) {
         switch (opt) {
             case 's':
                 packet_size = atoi(optarg);
@@ -375,9 +5729,99 @@ int main(int argc, char *argv[]) {
                     return EXIT_FAILURE;
                 }
                 break;
+            case 'W':
+                window = atoi(optarg);
+                if (window < 1 || window > MAX_WINDOW) {
+                    fprintf(stderr, "Invalid window. Must be between 1 and %d.\n", MAX_WINDOW);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'B':
+                batch = atoi(optarg);
+                if (batch < 1 || batch > MAX_BATCH) {
+                    fprintf(stderr, "Invalid batch. Must be between 1 and %d.\n", MAX_BATCH);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'P':
+                threads = atoi(optarg);
+                if (threads < 1 || threads > MAX_THREADS) {
+                    fprintf(stderr, "Invalid thread count. Must be between 1 and %d.\n", MAX_THREADS);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'R':
+                use_ring = true;
+                break;
+            case 'p':
+                rate_arg = optarg;
+                break;
+            case 'U':
+                use_uring = true;
+                break;
+            case 'T':
+                kernel_timestamps = true;
+                break;
+            case 'C':
+                integrity_mode = INTEGRITY_CRC32C;
+                break;
+            case 'd':
+                dgram_socket = true;
+                break;
+            case 'X':
+                sweep_spec = optarg;
+                break;
+            case 'f':
+                target_file = optarg;
+                break;
             case 'l':
                 logfile_name = optarg;
                 break;
+            case 'o':
+                results_name = optarg;
+                break;
+            case 'D':
+                return run_result_dump(optarg);
+            case 'M':
+                metrics_arg = optarg;
+                break;
+            case 'A':
+                rto_min_ms = atof(optarg);
+                if (rto_min_ms <= 0) {
+                    fprintf(stderr, "Invalid RTO floor. Must be a positive number of ms.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'J': {
+                char *end;
+                jitter_cpu = strtol(optarg, &end, 10);
+                if (*end == ':') {
+                    jitter_priority = strtol(end + 1, &end, 10);
+                    if (jitter_priority < 1 || jitter_priority > sched_get_priority_max(SCHED_FIFO)) {
+                        fprintf(stderr, "Invalid SCHED_FIFO priority. Must be between 1 and %d.\n",
+                                sched_get_priority_max(SCHED_FIFO));
+                        return EXIT_FAILURE;
+                    }
+                }
+                if (end == optarg || *end != '\0' || jitter_cpu < 0 || jitter_cpu >= CPU_SETSIZE) {
+                    fprintf(stderr, "Invalid low-jitter spec '%s'. Use <cpu> or <cpu>:<priority>.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'v':
+                stdout_verbosity = atoi(optarg);
+                if (stdout_verbosity < LOG_SUMMARY || stdout_verbosity > LOG_REPLIES) {
+                    fprintf(stderr, "Invalid verbosity. Must be between %d and %d.\n", LOG_SUMMARY, LOG_REPLIES);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b':
+                benchmark = true;
+                break;
+            case 'e':
+                bench_csv_name = optarg;
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return EXIT_SUCCESS;
@@ -386,16 +5830,116 @@ int main(int argc, char *argv[]) {
                 return EXIT_FAILURE;
         }
     }
-    
-    // Get target from non-option arguments
-    if (optind < argc) {
-        target = argv[optind];
-    } else {
-        fprintf(stderr, "No target specified.\n");
-        print_usage(argv[0]);
+    
+    if (benchmark) {
+        return run_benchmarks(bench_csv_name);
+    }
+    if (bench_csv_name) {
+        fprintf(stderr, "-e only applies to benchmark runs (-b).\n");
+        return EXIT_FAILURE;
+    }
+
+    // Get target from non-option arguments; several targets (or -f) select multi-target mode
+    bool multi_target = target_file != NULL || argc - optind > 1;
+    if (optind < argc) {
+        target = argv[optind];
+    } else if (!target_file && !sweep_spec) {
+        fprintf(stderr, "No target specified.\n");
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    
+    if (multi_target && (window > 0 || use_uring || batch > 0 || threads > 0)) {
+        fprintf(stderr, "Multi-target mode cannot be combined with -W, -U, -B or -P.\n");
+        return EXIT_FAILURE;
+    }
+    if (sweep_spec && (target || target_file || threads > 0)) {
+        fprintf(stderr, "A sweep (-X) takes its targets from the spec and cannot be combined with -P.\n");
+        return EXIT_FAILURE;
+    }
+    if (dgram_socket && (use_uring || batch > 0 || threads > 0 || use_ring)) {
+        fprintf(stderr, "The datagram socket (-d) works with stop-and-wait, -W, -p, -X and several targets; "
+                "not with -U, -B, -R or -P.\n");
+        return EXIT_FAILURE;
+    }
+    if (jitter_cpu >= 0 && (multi_target || sweep_spec || use_uring || batch > 0 || threads > 0)) {
+        fprintf(stderr, "Low-jitter mode (-J) is for single-target stop-and-wait and pipelined (-W, -p) runs; "
+                "not with -U, -B, -P, -X or several targets.\n");
+        return EXIT_FAILURE;
+    }
+    if (rto_min_ms > 0 && (multi_target || batch > 0 || threads > 0)) {
+        fprintf(stderr, "The adaptive timeout (-A) is for stop-and-wait and pipelined (-W, -U, -p) runs; "
+                "not with -B, -P or several targets.\n");
         return EXIT_FAILURE;
     }
-    
+    if (rto_min_ms > 0 && rto_min_ms > timeout * 1000.0) {
+        fprintf(stderr, "The RTO floor (-A) cannot exceed the timeout (-w).\n");
+        return EXIT_FAILURE;
+    }
+    if (metrics_arg && sweep_spec) {
+        fprintf(stderr, "The metrics exporter (-M) is not available for sweeps (-X).\n");
+        return EXIT_FAILURE;
+    }
+    if (results_name && (multi_target || sweep_spec || threads > 0)) {
+        fprintf(stderr, "Binary results (-o) are only written for single-target runs without -P or -X.\n");
+        return EXIT_FAILURE;
+    }
+    if (multi_target && kernel_timestamps) {
+        fprintf(stderr, "Kernel timestamps are not supported in multi-target mode, ignoring -T.\n");
+        kernel_timestamps = false;
+    }
+
+    if ((window > 0 || use_uring) && batch > 0) {
+        fprintf(stderr, "Pipelined (-W, -U) and batch (-B) modes are mutually exclusive.\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((window > 0 || use_uring) && threads > 0) {
+        fprintf(stderr, "Pipelined (-W, -U) and multi-core flood (-P) modes are mutually exclusive.\n");
+        return EXIT_FAILURE;
+    }
+    if (threads > 0 && kernel_timestamps) {
+        fprintf(stderr, "Kernel timestamps are not supported in multi-core flood mode, ignoring -T.\n");
+        kernel_timestamps = false;
+    }
+
+    // The ring is a batch-mode receive path; its frames carry kernel timestamps
+    if (use_ring && (batch == 0 || threads > 0 || multi_target)) {
+        fprintf(stderr, "The packet ring (-R) is only available in single-threaded batch mode (-B).\n");
+        return EXIT_FAILURE;
+    }
+    if (use_ring) {
+        kernel_timestamps = true;
+    }
+
+    // Flood workers send in batches, 64 probes at a time unless -B says otherwise
+    if (threads > 0 && batch == 0) {
+        batch = 64;
+    }
+
+    // Paced mode drives the pipelined engine open loop, with a wide window so
+    // slow replies don't hold sends back
+    if (rate_arg && (batch > 0 || threads > 0 || multi_target)) {
+        fprintf(stderr, "Paced mode (-p) cannot be combined with -B, -P or multiple targets.\n");
+        return EXIT_FAILURE;
+    }
+    if (rate_arg && window == 0) {
+        window = PACE_WINDOW;
+    }
+
+    // The io_uring backend drives the pipelined engine, one probe in flight by default
+    if (use_uring && window == 0) {
+        window = 1;
+    }
+
+    // Batch mode floods unless an interval between batches is given
+    if (interval == -1 && batch > 0) {
+        interval = 0;
+    }
+
+    // Sweep cells pick their own mode default
+    int interval_arg = interval;
+
     // If interval not set, use mode default
     if (interval == -1) {
         interval = get_ping_interval();
@@ -408,6 +5952,33 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
     
+    if (rate_arg) {
+        pps = parse_rate(rate_arg, packet_size);
+        if (pps <= 0 || pps > 1e7) {
+            fprintf(stderr, "Invalid rate '%s'. Use e.g. 5000, 20k, 20kpps or 100Mbps (at most 10M pps).\n", rate_arg);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // The CRC32C digest needs room after the timestamp
+    if (integrity_mode == INTEGRITY_CRC32C &&
+        packet_size < sizeof(struct icmphdr) + sizeof(struct timeval) + sizeof(uint32_t)) {
+        fprintf(stderr, "CRC32C mode needs a packet size of at least %ld bytes.\n",
+                sizeof(struct icmphdr) + sizeof(struct timeval) + sizeof(uint32_t));
+        return EXIT_FAILURE;
+    }
+
+    if (sweep_spec) {
+        experiment_t base = { packet_size, count, interval_arg, timeout, retries, window, batch,
+                              use_uring, use_ring, threads, ttl, pps };
+        // Children inherit the handler; on Ctrl+C each finishes its current cell
+        signal(SIGINT, signal_handler);
+        return run_sweep(sweep_spec, &base, rate_arg);
+    }
+
+    // Build the payload template now, before any worker thread needs it
+    get_payload_template(packet_size);
+
     // Open log file if specified
     if (logfile_name) {
         logfile = fopen(logfile_name, "w");
@@ -418,38 +5989,91 @@ int main(int argc, char *argv[]) {
     }
 
     // Create raw socket
-    sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+    sockfd = open_probe_socket(ttl, timeout);
     if (sockfd < 0) {
-        perror("socket creation failed");
-        fprintf(stderr, "Note: This program requires root privileges to create raw sockets.\n");
         if (logfile) fclose(logfile);
         return EXIT_FAILURE;
     }
 
-    // Set socket receive buffer size (NEW CODE)
-    int rcvbufsize = 1024 * 1024; // 1MB buffer
-    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbufsize, sizeof(rcvbufsize)) < 0) {
-        perror("setsockopt SO_RCVBUF failed");
-        // Non-fatal, continue execution
+    // Enable kernel timestamping if requested, else fall back to CLOCK_MONOTONIC
+    if (kernel_timestamps && !enable_kernel_timestamps(sockfd)) {
+        perror("setsockopt SO_TIMESTAMPING failed, using CLOCK_MONOTONIC");
+        kernel_timestamps = false;
     }
 
-    // Set TTL value
-    if (setsockopt(sockfd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) < 0) {
-        perror("setsockopt IP_TTL failed");
-        close(sockfd);
-        if (logfile) fclose(logfile);
-        return EXIT_FAILURE;
-    }
+    // Format and write log lines on their own thread from here on
+    log_start();
 
-    // Set timeout for receiving
-    struct timeval tv;
-    tv.tv_sec = timeout;
-    tv.tv_usec = 0;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
-        perror("setsockopt SO_RCVTIMEO failed");
-        close(sockfd);
+    if (multi_target) {
+        // Collect targets from the command line and the target file
+        char **hosts = NULL;
+        int *intervals = NULL;
+        int host_count = 0, capacity = argc - optind;
+        if (capacity > 0) {
+            hosts = malloc(capacity * sizeof(char *));
+            intervals = malloc(capacity * sizeof(int));
+            for (int i = optind; i < argc; i++) {
+                hosts[host_count] = strdup(argv[i]);
+                intervals[host_count++] = interval;
+            }
+        }
+
+        target_set_t set = {0};
+        int status = EXIT_FAILURE;
+        char *packet = malloc(packet_size);
+        if (packet &&
+            (!target_file || read_target_file(target_file, &hosts, &intervals, &host_count,
+                                              &capacity, interval) == 0) &&
+            target_set_init(&set, hosts, intervals, host_count)) {
+            signal(SIGINT, signal_handler);
+            if (metrics_arg && !start_metrics_server(metrics_arg, "multiple", packet_size)) {
+                fprintf(stderr, "Continuing without the metrics exporter.\n");
+            }
+
+            // Have the kernel drop ICMP traffic that isn't ours (a datagram socket already does)
+            if (!dgram_socket) {
+                in_addr_t *sources = malloc(set.count * sizeof(in_addr_t));
+                for (int i = 0; sources && i < set.count; i++) {
+                    sources[i] = set.targets[i].addr.sin_addr.s_addr;
+                }
+                if (!sources || !attach_reply_filter(sockfd, ident, sources, set.count)) {
+                    perror("setsockopt SO_ATTACH_FILTER failed");
+                }
+                free(sources);
+            }
+
+            log_message("PING %d targets: %d bytes of data with %s mode\n",
+                        set.count, packet_size - sizeof(struct icmphdr),
+                        mode == MODE_STANDARD ? "standard" :
+                          (mode == MODE_AGGRESSIVE ? "aggressive" : "intermittent"));
+            run_multi_target(&set, packet, packet_size, count, timeout, retries);
+
+            // Per-target results, then the totals
+            for (int i = 0; i < set.count; i++) {
+                char title[512];
+                snprintf(title, sizeof(title), "Ping Statistics for %s (%s)",
+                         set.targets[i].name, set.targets[i].ip);
+                print_statistics_for(title, &set.targets[i].stats);
+                stats_merge(&stats, &set.targets[i].stats);
+            }
+            print_statistics();
+            if (metrics_enabled) {
+                metrics_publish(&stats);
+            }
+            status = EXIT_SUCCESS;
+        } else if (packet) {
+            fprintf(stderr, "No usable targets.\n");
+        }
+
+        target_set_free(&set);
+        for (int i = 0; i < host_count; i++) free(hosts[i]);
+        free(hosts);
+        free(intervals);
+        free(packet);
+        log_stop();
         if (logfile) fclose(logfile);
-        return EXIT_FAILURE;
+        close(sockfd);
+        return status;
     }
 
     // Resolve target hostname to IP address
@@ -472,6 +6096,12 @@ int main(int argc, char *argv[]) {
     dest_addr.sin_port = 0; // Not used in ICMP
     inet_aton(ip_addr, &dest_addr.sin_addr);
 
+    // Have the kernel drop ICMP traffic that isn't ours (a datagram socket already does)
+    if (!dgram_socket && !attach_reply_filter(sockfd, ident, &dest_addr.sin_addr.s_addr, 1)) {
+        perror("setsockopt SO_ATTACH_FILTER failed");
+        // Non-fatal, replies are still matched in user space
+    }
+
     // Register signal handler for Ctrl+C
     signal(SIGINT, signal_handler);
 
@@ -491,228 +6121,30 @@ int main(int argc, char *argv[]) {
                 mode == MODE_STANDARD ? "standard" : 
                   (mode == MODE_AGGRESSIVE ? "aggressive" : "intermittent"));
 
-    // Main ping loop
-    int seq_num = 0;
-    while (!stop_ping && (count == -1 || original_send_count < count)) {
-        // Flush socket before sending (NEW CODE)
-        flush_socket(sockfd);
-        
-        // Prepare packet
-        prepare_icmp_packet((struct icmphdr *)packet, seq_num, packet_size);
-        
-        // Add packet to history
-        add_packet_to_history(seq_num);
-        original_send_count++;
-        
-        // Try sending the packet (with retries if needed)
-        bool packet_received = false;
-        int current_tries = 0;
-        
-        while (!packet_received && current_tries <= retries) {
-            if (current_tries > 0) {
-                // This is a retry
-                resend_count++;
-                
-                // Update retry count in history
-                packet_history_t *pkt = find_packet(seq_num);
-                if (pkt) {
-                    pkt->retries++;
-                }
-                
-                // Prepare packet again with same sequence number
-                prepare_icmp_packet((struct icmphdr *)packet, seq_num, packet_size);
-                
-                // Log retry
-                log_message("Retrying seq=%d (attempt %d/%d)\n", seq_num, current_tries, retries);
-            }
-            
-            // Record send time
-            struct timeval send_time;
-            gettimeofday(&send_time, NULL);
-
-            // Send packet
-            int bytes_sent = sendto(sockfd, packet, packet_size, 0,
-                                   (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-
-            if (bytes_sent < 0) {
-                perror("sendto failed");
-            } else {
-                send_count++;
-            }
-
-            // Receive buffer
-            char recv_packet[MAX_PACKET_SIZE];
-            struct sockaddr_in recv_addr;
-            socklen_t addr_len = sizeof(recv_addr);
-            
-            // Loop to handle possible multiple responses (e.g., ICMP error messages)
-            fd_set read_set;
-            struct timeval wait_time;
-            bool response_received = false;
-            
-            // Set wait time for select()
-            wait_time.tv_sec = timeout;
-            wait_time.tv_usec = 0;
-            
-            // Wait for response with select()
-            FD_ZERO(&read_set);
-            FD_SET(sockfd, &read_set);
-            
-            // Track when we started waiting (NEW CODE)
-            struct timeval wait_start;
-            gettimeofday(&wait_start, NULL);
-            
-            // Remaining wait time (NEW CODE)
-            struct timeval remaining_time = wait_time;
-            
-            // Keep trying to receive until timeout (NEW CODE)
-            while (!response_received) {
-                // Wait up to remaining time for data to be available
-                int ready = select(sockfd + 1, &read_set, NULL, NULL, &remaining_time);
-                
-                // Check if we timed out
-                if (ready <= 0) {
-                    break; // Timeout or error
-                }
-                
-                // Try to receive
-                int bytes_received = recvfrom(sockfd, recv_packet, sizeof(recv_packet), 0,
-                                          (struct sockaddr *)&recv_addr, &addr_len);
-                
-                if (bytes_received <= 0) {
-                    continue; // Error receiving packet, try again
-                }
-                
-                // Record receive time
-                struct timeval recv_time;
-                gettimeofday(&recv_time, NULL);
-                
-                // Calculate round-trip time in milliseconds
-                double rtt = (recv_time.tv_sec - send_time.tv_sec) * 1000.0 +
-                            (recv_time.tv_usec - send_time.tv_usec) / 1000.0;
-                
-                // Parse IP header and ICMP header
-                struct iphdr *ip_header = (struct iphdr *)recv_packet;
-                int ip_header_len = ip_header->ihl * 4;  // IP header length
-                
-                // Validate we have enough data for an ICMP header
-                if (bytes_received < ip_header_len + sizeof(struct icmphdr)) {
-                    continue; // Packet too small, try again
-                }
-                
-                struct icmphdr *icmp_header = (struct icmphdr *)(recv_packet + ip_header_len);
-                int data_size = bytes_received - ip_header_len - sizeof(struct icmphdr);
-                
-                // Check if it's our echo reply - STRICT VALIDATION
-                if (icmp_header->type == ICMP_ECHOREPLY &&
-                    icmp_header->un.echo.id == ident &&
-                    icmp_header->un.echo.sequence == seq_num &&
-                    recv_addr.sin_addr.s_addr == dest_addr.sin_addr.s_addr) {
-                    
-                    // Sanity check for RTT - reject impossibly fast responses
-                    // Even loopback shouldn't be less than ~0.05ms
-                    if (rtt < 0.05 && strcmp(inet_ntoa(recv_addr.sin_addr), "127.0.0.1") != 0) {
-                        log_message("Suspicious RTT (%.3f ms) from %s for icmp_seq=%d - ignoring\n",
-                                  rtt, inet_ntoa(recv_addr.sin_addr), seq_num);
-                        continue; // Try for another packet
-                    }
-                    
-                    recv_count++;
-                    packet_received = true;
-                    response_received = true;
-                    
-                    // Verify checksum and data integrity
-                    bool checksum_valid = verify_checksum((unsigned short *)icmp_header, 
-                                                        bytes_received - ip_header_len);
-                    bool data_valid = data_size > 0 ? 
-                                      verify_packet_integrity(icmp_header, data_size) : true;
-                    bool is_corrupted = !checksum_valid || !data_valid;
-                    
-                    if (is_corrupted) {
-                        corrupt_count++;
-                    }
-                    
-                    // Update packet history
-                    update_packet_history(seq_num, rtt, is_corrupted);
-                    
-                    // Print information
-                    log_message("%d bytes from %s: icmp_seq=%d ttl=%d time=%.3f ms %s\n",
-                               bytes_received - ip_header_len,
-                               inet_ntoa(recv_addr.sin_addr),
-                               icmp_header->un.echo.sequence,
-                               ip_header->ttl,
-                               rtt,
-                               is_corrupted ? "[CORRUPTED]" : "");
-                    
-                    if (is_corrupted) {
-                        log_message("  Corruption details: checksum=%s, data=%s\n",
-                                   checksum_valid ? "valid" : "invalid",
-                                   data_valid ? "valid" : "invalid");
-                    }
-                }
-                else if (icmp_header->type == ICMP_DEST_UNREACH) {
-                    // Handle destination unreachable message
-                    log_message("From %s: Destination unreachable (code=%d) for icmp_seq=%d\n",
-                              inet_ntoa(recv_addr.sin_addr),
-                              icmp_header->code,
-                              seq_num);
-                }
-                else if (icmp_header->type == ICMP_TIME_EXCEEDED) {
-                    // Handle time exceeded message
-                    log_message("From %s: Time to live exceeded for icmp_seq=%d\n",
-                              inet_ntoa(recv_addr.sin_addr),
-                              seq_num);
-                }
-                
-                // Calculate remaining wait time
-                struct timeval current_time;
-                gettimeofday(&current_time, NULL);
-                
-                // Calculate elapsed time
-                long elapsed_usec = (current_time.tv_sec - wait_start.tv_sec) * 1000000 + 
-                                    (current_time.tv_usec - wait_start.tv_usec);
-                
-                // Calculate remaining time
-                long remaining_usec = timeout * 1000000 - elapsed_usec;
-                
-                if (remaining_usec <= 0) {
-                    break; // We've exceeded our timeout
-                }
-                
-                // Update remaining_time for next select call
-                remaining_time.tv_sec = remaining_usec / 1000000;
-                remaining_time.tv_usec = remaining_usec % 1000000;
-                
-                // Reset fd_set for next select call
-                FD_ZERO(&read_set);
-                FD_SET(sockfd, &read_set);
-            }
-            
-            if (!response_received) {
-                log_message("Request timeout for icmp_seq=%d (try %d/%d)\n", 
-                          seq_num, current_tries + 1, retries + 1);
-            }
-            
-            current_tries++;
-            
-            // If packet received or max retries reached, move to next sequence
-            if (packet_received || current_tries > retries) {
-                break;
-            }
-            
-            // Wait before retry
-            usleep(RETRY_INTERVAL * 1000);
-        }
-
-        seq_num++;
-
-        // Check if we've reached the requested count
-        if (count != -1 && original_send_count >= count) {
-            break;
-        }
-
-        // Sleep for the interval before sending the next packet
-        usleep(interval * 1000);
+    experiment_t exp = { packet_size, count, interval, timeout, retries, window, batch,
+                         use_uring, use_ring, threads, ttl, pps };
+    if (results_name && !results_open(results_name, &exp, target, ip_addr)) {
+        free(packet);
+        log_stop();
+        close(sockfd);
+        if (logfile) fclose(logfile);
+        return EXIT_FAILURE;
+    }
+    if (metrics_arg && !start_metrics_server(metrics_arg, target, packet_size)) {
+        fprintf(stderr, "Continuing without the metrics exporter.\n");
+    }
+    if (jitter_cpu >= 0 && !enter_low_jitter(jitter_cpu, jitter_priority)) {
+        results_close();
+        free(packet);
+        log_stop();
+        close(sockfd);
+        if (logfile) fclose(logfile);
+        return EXIT_FAILURE;
+    }
+    run_experiment(&exp, packet);
+    results_close();
+    if (metrics_enabled) {
+        metrics_publish(&stats);
     }
 
     // Print statistics
@@ -720,6 +6152,7 @@ int main(int argc, char *argv[]) {
 
     // Free resources
     free(packet);
+    log_stop();
     if (logfile) {
         fclose(logfile);
     }
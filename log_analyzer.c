@@ -0,0 +1,644 @@
+// Log analyzer for enhanced_ping text logs
+// Summarizes every log under the given files and directories: per-reply lines
+// and the "--- Ping Statistics ---" block are parsed straight from a mapping
+// of each file, run parameters come from the file name, and files are spread
+// over worker threads.
+//
+// Build: gcc -O2 -o log_analyzer log_analyzer.c -lm -pthread
+
+#define _GNU_SOURCE             // memmem()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Define constants
+// -------------------------------------------------------------------
+#define MAX_THREADS     256     // Most worker threads
+#define MAX_GROUP_KEYS  5       // dir, target, size, mode, interval
+
+// Group-by keys
+typedef enum {
+    KEY_DIR,
+    KEY_TARGET,
+    KEY_SIZE,
+    KEY_MODE,
+    KEY_INTERVAL
+} group_key_t;
+
+// Everything learned from one log file
+typedef struct {
+    char *path;
+    char dir[256];            // Directory the log is in
+    char target[128];         // File name before _s<size> (host, possibly with a scenario prefix)
+    int size;                 // -1 if the name doesn't say
+    int mode;
+    int interval;
+    int count;                // From a sweep's _c<count> suffix, else -1
+
+    // From the statistics block (-1 if missing)
+    int sent;
+    int sent_total;
+    int received;
+    int retransmitted;
+    int rereceived;
+    int corrupted;
+    bool complete;            // Statistics block found
+    double footer_rtt[8];     // min, avg, max, stddev, p50, p90, p99, p99.9 from the RTT lines
+    int footer_rtt_count;     // How many of those were present
+
+    // From the per-probe lines
+    int replies;              // Reply lines parsed
+    int corrupted_lines;      // Replies marked [CORRUPTED]
+    int timeouts;             // "Request timeout" lines
+    int icmp_errors;          // Destination unreachable / time exceeded lines
+    int max_seq;              // Highest icmp_seq seen, -1 if none
+    double *rtts;             // RTTs (ms) of intact replies
+    int rtt_count;
+    int rtt_capacity;
+    bool failed;              // Couldn't be read
+} log_summary_t;
+
+// A set of files sharing the group-by keys
+typedef struct {
+    char key[512];
+    int first;                // Index of the first file, whose fields name the group
+    int files;
+    long long sent;
+    long long received;
+    long long corrupted;
+    long long timeouts;
+    double *rtts;
+    long long rtt_count;
+} group_t;
+
+// Global variables for the program
+log_summary_t *logs;
+int log_count = 0;
+int log_capacity = 0;
+int next_log = 0;             // Next file for a worker to take
+group_key_t group_keys[MAX_GROUP_KEYS] = { KEY_DIR, KEY_SIZE, KEY_MODE };
+int group_key_count = 3;
+
+// Parsing
+// -------------------------------------------------------------------
+// The mapping is not NUL-terminated, so every scan is bounded by `end`
+
+// Parse an unsigned integer at p; returns the position after it or NULL
+const char *parse_int(const char *p, const char *end, int *out) {
+    if (p >= end || *p < '0' || *p > '9') {
+        return NULL;
+    }
+    long long v = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (*p++ - '0');
+        if (v > INT32_MAX) v = INT32_MAX;
+    }
+    *out = (int)v;
+    return p;
+}
+
+// Parse a non-negative decimal such as 0.582; returns the position after it or NULL
+const char *parse_decimal(const char *p, const char *end, double *out) {
+    if (p >= end || *p < '0' || *p > '9') {
+        return NULL;
+    }
+    double v = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (*p++ - '0');
+    }
+    if (p < end && *p == '.') {
+        double scale = 0.1;
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, scale /= 10) {
+            v += (*p - '0') * scale;
+        }
+    }
+    *out = v;
+    return p;
+}
+
+// Find `needle` within [p, end); NULL if absent
+const char *find(const char *p, const char *end, const char *needle) {
+    return memmem(p, end - p, needle, strlen(needle));
+}
+
+// True if the line starts with `prefix`; *rest points after it
+bool starts_with(const char *p, const char *end, const char *prefix, const char **rest) {
+    size_t n = strlen(prefix);
+    if ((size_t)(end - p) < n || memcmp(p, prefix, n) != 0) {
+        return false;
+    }
+    *rest = p + n;
+    return true;
+}
+
+void add_rtt(log_summary_t *s, double rtt) {
+    if (s->rtt_count == s->rtt_capacity) {
+        int capacity = s->rtt_capacity ? s->rtt_capacity * 2 : 1024;
+        double *rtts = realloc(s->rtts, capacity * sizeof(double));
+        if (!rtts) {
+            return;
+        }
+        s->rtts = rtts;
+        s->rtt_capacity = capacity;
+    }
+    s->rtts[s->rtt_count++] = rtt;
+}
+
+// Parse one line of a log
+void parse_line(log_summary_t *s, const char *p, const char *end) {
+    const char *rest;
+    int n;
+
+    // "1024 bytes from 192.168.122.34: icmp_seq=0 ttl=64 time=0.582 ms [CORRUPTED]"
+    if (*p >= '0' && *p <= '9') {
+        const char *q = parse_int(p, end, &n);
+        if (!q || !starts_with(q, end, " bytes from ", &rest)) {
+            return;
+        }
+        s->replies++;
+        const char *seq = find(rest, end, "icmp_seq=");
+        if (seq && parse_int(seq + 9, end, &n) && n > s->max_seq) {
+            s->max_seq = n;
+        }
+        bool corrupted = find(rest, end, "[CORRUPTED]") != NULL;
+        const char *time = find(rest, end, "time=");
+        double rtt;
+        if (corrupted) {
+            s->corrupted_lines++;
+        } else if (time && parse_decimal(time + 5, end, &rtt)) {
+            add_rtt(s, rtt);
+        }
+        return;
+    }
+
+    if (starts_with(p, end, "Request timeout", &rest)) {
+        s->timeouts++;
+    } else if (starts_with(p, end, "From ", &rest)) {
+        if (find(rest, end, "Destination unreachable") || find(rest, end, "Time to live exceeded")) {
+            s->icmp_errors++;
+        }
+    } else if (starts_with(p, end, "Total packets: ", &rest)) {
+        // "Total packets: 50 original, 50 including retries"
+        const char *q = parse_int(rest, end, &s->sent);
+        if (q && starts_with(q, end, " original, ", &q)) {
+            parse_int(q, end, &s->sent_total);
+        }
+    } else if (starts_with(p, end, "Received: ", &rest)) {
+        parse_int(rest, end, &s->received);
+    } else if (starts_with(p, end, "Retransmitted: ", &rest)) {
+        parse_int(rest, end, &s->retransmitted);
+    } else if (starts_with(p, end, "Received after retry: ", &rest)) {
+        parse_int(rest, end, &s->rereceived);
+    } else if (starts_with(p, end, "Corrupted packets: ", &rest)) {
+        parse_int(rest, end, &s->corrupted);
+    } else if (starts_with(p, end, "RTT min/avg/max = ", &rest)) {
+        // Used when the log has no reply lines to take RTTs from
+        const char *q = rest;
+        for (int i = 0; i < 3 && q && (q = parse_decimal(q, end, &s->footer_rtt[i])); i++) {
+            if (q < end && *q == '/') q++;
+            if (i == 2) s->footer_rtt_count = 3;
+        }
+    } else if (starts_with(p, end, "RTT stddev = ", &rest)) {
+        if (s->footer_rtt_count == 3 && parse_decimal(rest, end, &s->footer_rtt[3])) {
+            s->footer_rtt_count = 4;
+        }
+    } else if (starts_with(p, end, "RTT p50/p90/p99/p99.9 = ", &rest)) {
+        const char *q = rest;
+        for (int i = 4; i < 8 && s->footer_rtt_count == i && q && (q = parse_decimal(q, end, &s->footer_rtt[i])); i++) {
+            if (q < end && *q == '/') q++;
+            s->footer_rtt_count = i + 1;
+        }
+    } else if (starts_with(p, end, "--- Ping Statistics ---", &rest)) {
+        s->complete = true;
+    }
+}
+
+// Decode run parameters from a name like 192_168_122_34_s1024_m1_i100ms.log
+// (the interval and a sweep's _c<count> are optional)
+void parse_file_name(log_summary_t *s) {
+    const char *slash = strrchr(s->path, '/');
+    const char *name = slash ? slash + 1 : s->path;
+    int dir_len = slash ? (int)(slash - s->path) : 1;
+    snprintf(s->dir, sizeof(s->dir), "%.*s", dir_len, slash ? s->path : ".");
+
+    s->size = s->mode = s->interval = s->count = -1;
+    const char *end = name + strlen(name);
+    if (end - name > 4 && strcmp(end - 4, ".log") == 0) {
+        end -= 4;
+    }
+    snprintf(s->target, sizeof(s->target), "%.*s", (int)(end - name), name);
+
+    // The last "_s<digits>_m<digits>" marks where the parameters start
+    for (const char *p = end - 1; p >= name; p--) {
+        int size, mode;
+        const char *q;
+        if (p[0] != '_' || p + 1 >= end || p[1] != 's' || !(q = parse_int(p + 2, end, &size)) ||
+            !starts_with(q, end, "_m", &q) || !(q = parse_int(q, end, &mode))) {
+            continue;
+        }
+        s->size = size;
+        s->mode = mode;
+        snprintf(s->target, sizeof(s->target), "%.*s", (int)(p - name), name);
+        if (starts_with(q, end, "_i", &q)) {
+            q = parse_int(q, end, &s->interval);
+            if (q) starts_with(q, end, "ms", &q);
+        }
+        if (q && starts_with(q, end, "_c", &q)) {
+            parse_int(q, end, &s->count);
+        }
+        break;
+    }
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Read and summarize one log
+void analyze_log(log_summary_t *s) {
+    s->sent = s->sent_total = s->received = -1;
+    s->retransmitted = s->rereceived = s->corrupted = -1;
+    s->max_seq = -1;
+    parse_file_name(s);
+
+    int fd = open(s->path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(s->path);
+        s->failed = true;
+        if (fd >= 0) close(fd);
+        return;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return;
+    }
+    const char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(s->path);
+        s->failed = true;
+        return;
+    }
+    madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+
+    const char *end = map + st.st_size;
+    for (const char *p = map; p < end; ) {
+        const char *nl = memchr(p, '\n', end - p);
+        const char *line_end = nl ? nl : end;
+        if (line_end > p) {
+            parse_line(s, p, line_end);
+        }
+        p = line_end + 1;
+    }
+    munmap((void *)map, st.st_size);
+    qsort(s->rtts, s->rtt_count, sizeof(double), compare_doubles);
+
+    // A log cut short has no statistics block; fall back to what the lines say
+    if (s->sent < 0) {
+        s->sent = s->max_seq + 1 > s->timeouts ? s->max_seq + 1 : s->timeouts;
+        s->received = s->replies;
+        s->corrupted = s->corrupted_lines;
+    }
+}
+
+// Worker thread: take files until none are left
+void *analyze_worker(void *arg) {
+    (void)arg;
+    for (;;) {
+        int i = __atomic_fetch_add(&next_log, 1, __ATOMIC_RELAXED);
+        if (i >= log_count) {
+            return NULL;
+        }
+        analyze_log(&logs[i]);
+    }
+}
+
+// Collecting files
+// -------------------------------------------------------------------
+void add_log(const char *path) {
+    if (log_count == log_capacity) {
+        log_capacity = log_capacity ? log_capacity * 2 : 256;
+        logs = realloc(logs, log_capacity * sizeof(log_summary_t));
+        if (!logs) {
+            perror("Failed to allocate file list");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memset(&logs[log_count], 0, sizeof(log_summary_t));
+    logs[log_count++].path = strdup(path);
+}
+
+int collect_log(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st; (void)ftw;
+    size_t len = strlen(path);
+    if (type == FTW_F && len > 4 && strcmp(path + len - 4, ".log") == 0) {
+        add_log(path);
+    }
+    return 0;
+}
+
+int compare_paths(const void *a, const void *b) {
+    return strcmp(((const log_summary_t *)a)->path, ((const log_summary_t *)b)->path);
+}
+
+// Output
+// -------------------------------------------------------------------
+// Print an integer field, empty if unknown
+void print_int(FILE *out, long long v) {
+    if (v >= 0) fprintf(out, "%lld", v);
+    fputc(',', out);
+}
+
+// RTT columns from a sorted sample: min,avg,max,stddev,p50,p90,p99,p99.9
+// (nearest-rank percentiles, as in enhanced_ping's statistics)
+void print_rtt_columns(FILE *out, const double *rtts, long long n) {
+    if (n == 0) {
+        fputs(",,,,,,,", out);
+        return;
+    }
+    double sum = 0, sq = 0;
+    for (long long i = 0; i < n; i++) {
+        sum += rtts[i];
+    }
+    double mean = sum / n;
+    for (long long i = 0; i < n; i++) {
+        sq += (rtts[i] - mean) * (rtts[i] - mean);
+    }
+    const double fractions[] = { 0.50, 0.90, 0.99, 0.999 };
+    fprintf(out, "%.3f,%.3f,%.3f,%.3f", rtts[0], mean, rtts[n - 1], n > 1 ? sqrt(sq / (n - 1)) : 0.0);
+    for (int i = 0; i < 4; i++) {
+        long long rank = (long long)ceil(fractions[i] * n);
+        if (rank < 1) rank = 1;
+        fprintf(out, ",%.3f", rtts[rank - 1]);
+    }
+}
+
+void print_loss(FILE *out, long long sent, long long received) {
+    if (sent > 0 && received >= 0) {
+        fprintf(out, "%.2f", 100.0 * (sent - received) / sent);
+    }
+    fputc(',', out);
+}
+
+void print_file_csv(FILE *out) {
+    fprintf(out, "file,dir,target,size,mode,interval_ms,count,complete,sent,sent_total,received,loss_pct,"
+                 "retransmitted,received_after_retry,corrupted,timeouts,icmp_errors,"
+                 "rtt_min,rtt_avg,rtt_max,rtt_stddev,rtt_p50,rtt_p90,rtt_p99,rtt_p999\n");
+    for (int i = 0; i < log_count; i++) {
+        const log_summary_t *s = &logs[i];
+        if (s->failed) continue;
+        fprintf(out, "%s,%s,%s,", s->path, s->dir, s->target);
+        print_int(out, s->size);
+        print_int(out, s->mode);
+        print_int(out, s->interval);
+        print_int(out, s->count);
+        fprintf(out, "%d,", s->complete);
+        print_int(out, s->sent);
+        print_int(out, s->sent_total);
+        print_int(out, s->received);
+        print_loss(out, s->sent, s->received);
+        print_int(out, s->retransmitted);
+        print_int(out, s->rereceived);
+        print_int(out, s->corrupted);
+        print_int(out, s->timeouts);
+        print_int(out, s->icmp_errors);
+        if (s->rtt_count == 0 && s->footer_rtt_count > 0) {
+            for (int k = 0; k < 8; k++) {
+                if (k < s->footer_rtt_count) fprintf(out, "%.3f", s->footer_rtt[k]);
+                if (k < 7) fputc(',', out);
+            }
+        } else {
+            print_rtt_columns(out, s->rtts, s->rtt_count);
+        }
+        fputc('\n', out);
+    }
+}
+
+// Group key of a file, e.g. "speed_ping_logs,512,1"
+void group_key(const log_summary_t *s, char *key, size_t size) {
+    int len = 0;
+    key[0] = '\0';
+    for (int k = 0; k < group_key_count && len < (int)size; k++) {
+        const char *sep = k ? "," : "";
+        switch (group_keys[k]) {
+            case KEY_DIR:      len += snprintf(key + len, size - len, "%s%s", sep, s->dir); break;
+            case KEY_TARGET:   len += snprintf(key + len, size - len, "%s%s", sep, s->target); break;
+            case KEY_SIZE:     len += snprintf(key + len, size - len, "%s%d", sep, s->size); break;
+            case KEY_MODE:     len += snprintf(key + len, size - len, "%s%d", sep, s->mode); break;
+            case KEY_INTERVAL: len += snprintf(key + len, size - len, "%s%d", sep, s->interval); break;
+        }
+    }
+}
+
+void print_group_csv(FILE *out) {
+    static const char *names[] = { "dir", "target", "size", "mode", "interval_ms" };
+    group_t *groups = calloc(log_count ? log_count : 1, sizeof(group_t));
+    int group_count = 0;
+    if (!groups) {
+        perror("Failed to allocate groups");
+        return;
+    }
+
+    // Files are sorted, so a group's members are usually adjacent; check the last group first
+    for (int i = 0; i < log_count; i++) {
+        const log_summary_t *s = &logs[i];
+        if (s->failed) continue;
+        char key[512];
+        group_key(s, key, sizeof(key));
+        int g = group_count - 1;
+        if (g < 0 || strcmp(groups[g].key, key) != 0) {
+            for (g = 0; g < group_count && strcmp(groups[g].key, key) != 0; g++);
+            if (g == group_count) {
+                snprintf(groups[g].key, sizeof(groups[g].key), "%s", key);
+                groups[g].first = i;
+                group_count++;
+            }
+        }
+        group_t *grp = &groups[g];
+        grp->files++;
+        grp->sent += s->sent > 0 ? s->sent : 0;
+        grp->received += s->received > 0 ? s->received : 0;
+        grp->corrupted += s->corrupted > 0 ? s->corrupted : 0;
+        grp->timeouts += s->timeouts;
+        grp->rtt_count += s->rtt_count;
+    }
+
+    for (int k = 0; k < group_key_count; k++) {
+        fprintf(out, "%s,", names[group_keys[k]]);
+    }
+    fprintf(out, "files,sent,received,loss_pct,corrupted,timeouts,"
+                 "rtt_min,rtt_avg,rtt_max,rtt_stddev,rtt_p50,rtt_p90,rtt_p99,rtt_p999\n");
+
+    for (int g = 0; g < group_count; g++) {
+        group_t *grp = &groups[g];
+
+        // Pool every member's RTTs for the group's percentiles
+        grp->rtts = malloc((grp->rtt_count ? grp->rtt_count : 1) * sizeof(double));
+        long long n = 0;
+        char key[512];
+        for (int i = grp->first; grp->rtts && i < log_count; i++) {
+            if (logs[i].failed) continue;
+            group_key(&logs[i], key, sizeof(key));
+            if (strcmp(key, grp->key) == 0) {
+                memcpy(grp->rtts + n, logs[i].rtts, logs[i].rtt_count * sizeof(double));
+                n += logs[i].rtt_count;
+            }
+        }
+        qsort(grp->rtts, n, sizeof(double), compare_doubles);
+
+        fprintf(out, "%s,%d,%lld,%lld,", grp->key, grp->files, grp->sent, grp->received);
+        print_loss(out, grp->sent, grp->received);
+        fprintf(out, "%lld,%lld,", grp->corrupted, grp->timeouts);
+        print_rtt_columns(out, grp->rtts, n);
+        fputc('\n', out);
+        free(grp->rtts);
+    }
+    free(groups);
+}
+
+// Parse a -g list such as "dir,size,mode"
+bool parse_group_keys(char *arg) {
+    group_key_count = 0;
+    for (char *tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+        group_key_t key;
+        if (strcmp(tok, "dir") == 0) key = KEY_DIR;
+        else if (strcmp(tok, "target") == 0) key = KEY_TARGET;
+        else if (strcmp(tok, "size") == 0) key = KEY_SIZE;
+        else if (strcmp(tok, "mode") == 0) key = KEY_MODE;
+        else if (strcmp(tok, "interval") == 0) key = KEY_INTERVAL;
+        else {
+            fprintf(stderr, "Unknown group key '%s'.\n", tok);
+            return false;
+        }
+        if (group_key_count == MAX_GROUP_KEYS) {
+            fprintf(stderr, "At most %d group keys.\n", MAX_GROUP_KEYS);
+            return false;
+        }
+        group_keys[group_key_count++] = key;
+    }
+    return group_key_count > 0;
+}
+
+// Print usage information
+void print_usage(char *prog_name) {
+    fprintf(stderr, "Usage: %s [options] <log file or directory>...\n", prog_name);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -o <file>      Per-file CSV (default: stdout)\n");
+    fprintf(stderr, "  -G <file>      Also write per-group CSV (- for stdout)\n");
+    fprintf(stderr, "  -g <keys>      Group by these of dir,target,size,mode,interval (default: dir,size,mode)\n");
+    fprintf(stderr, "  -j <threads>   Worker threads (default: one per CPU)\n");
+    fprintf(stderr, "  -h             Show this help message\n");
+}
+
+// Main function
+// -------------------------------------------------------------------
+int main(int argc, char *argv[]) {
+    char *file_csv = NULL;
+    char *group_csv = NULL;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:G:g:j:h")) != -1) {
+        switch (opt) {
+            case 'o':
+                file_csv = optarg;
+                break;
+            case 'G':
+                group_csv = optarg;
+                break;
+            case 'g':
+                if (!parse_group_keys(optarg)) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                if (threads < 1 || threads > MAX_THREADS) {
+                    fprintf(stderr, "Invalid thread count. Must be between 1 and %d.\n", MAX_THREADS);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (threads < 1) threads = 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+    // Gather the logs, in path order so the output is stable
+    for (int i = optind; i < argc; i++) {
+        struct stat st;
+        if (stat(argv[i], &st) < 0) {
+            perror(argv[i]);
+            return EXIT_FAILURE;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            nftw(argv[i], collect_log, 32, FTW_PHYS);
+        } else {
+            add_log(argv[i]);
+        }
+    }
+    qsort(logs, log_count, sizeof(log_summary_t), compare_paths);
+
+    if (threads > log_count) threads = log_count > 0 ? log_count : 1;
+    pthread_t workers[MAX_THREADS];
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&workers[i], NULL, analyze_worker, NULL) == 0) {
+            started++;
+        }
+    }
+    analyze_worker(NULL); // Help out, and finish alone if no thread started
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    FILE *out = file_csv ? fopen(file_csv, "w") : stdout;
+    if (!out) {
+        perror(file_csv);
+        return EXIT_FAILURE;
+    }
+    print_file_csv(out);
+    if (out != stdout) fclose(out);
+
+    if (group_csv) {
+        out = strcmp(group_csv, "-") == 0 ? stdout : fopen(group_csv, "w");
+        if (!out) {
+            perror(group_csv);
+            return EXIT_FAILURE;
+        }
+        if (out == stdout && !file_csv) fputc('\n', out);
+        print_group_csv(out);
+        if (out != stdout) fclose(out);
+    }
+
+    int failed = 0;
+    for (int i = 0; i < log_count; i++) {
+        failed += logs[i].failed;
+        free(logs[i].path);
+        free(logs[i].rtts);
+    }
+    free(logs);
+    fprintf(stderr, "%d logs analyzed%s\n", log_count - failed, failed ? ", some unreadable" : "");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}